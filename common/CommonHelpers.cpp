@@ -25,7 +25,6 @@
 #include <common/CommonHelpers.h>
 #include "Localization.h"
 
-#include <map>
 #include <sddl.h>
 #include <string>
 
@@ -122,55 +121,26 @@ CStringW GetAppFolder()
     return folder.Left(folder.ReverseFind(wds::chrBackslash));
 }
 
-constexpr DWORD SidGetLength(PSID x)
-{
-    return sizeof(SID) + (static_cast<SID*>(x)->SubAuthorityCount - 1) * sizeof(static_cast<SID*>(x)->SubAuthority);
-};
-
+// Looks up the account name of a sid without any caching; see OwnerTable
+// for the cached lookup used by the views.
+//
 std::wstring GetNameFromSid(const PSID sid)
 {
     // return immediately if sid is null
     if (sid == nullptr) return L"";
 
-    // define custom lookup function
-    auto comp = [](const PSID p1, const PSID p2)
-    {
-        const DWORD l1 = SidGetLength(p1);
-        const DWORD l2 = SidGetLength(p2);
-        if (l1 != l2) return l1 < l2;
-        return memcmp(p1, p2, l1) > 0;
-    };
-
-    // attempt to lookup sid in cache
-    static std::map<PSID, std::wstring, decltype(comp)> name_map(comp);
-    const auto iter = name_map.find(sid);
-    if (iter != name_map.end())
-    {
-        return iter->second;
-    }
-
-    // copy the sid for storage in our cache table
-    const DWORD sid_length = SidGetLength(sid);
-    const auto sid_copy = memcpy(malloc(sid_length), sid, sid_length);
-
     // lookup the name for this sid
     SID_NAME_USE name_use;
-    WCHAR account_name[UNLEN + 1], domain_name[UNLEN + 1];;
+    WCHAR account_name[UNLEN + 1], domain_name[UNLEN + 1];
     DWORD iAccountNameSize = _countof(account_name), iDomainName = _countof(domain_name);
     if (LookupAccountSid(nullptr, sid, account_name,
         &iAccountNameSize, domain_name, &iDomainName, &name_use) == 0)
     {
         SmartPointer<LPWSTR> sid_buff(LocalFree);
-        ConvertSidToStringSid(sid, &sid_buff);
-        name_map[sid_copy] = sid_buff;
-    }
-    else
-    {
-        // generate full name in domain\name format
-        name_map[sid_copy] = std::wstring(domain_name) +
-            L"\\" + std::wstring(account_name);
+        if (ConvertSidToStringSid(sid, &sid_buff) == 0) return L"";
+        return static_cast<LPWSTR>(sid_buff);
     }
 
-    // return name
-    return name_map[sid_copy];
+    // generate full name in domain\name format
+    return std::wstring(domain_name) + L"\\" + std::wstring(account_name);
 }
@@ -450,6 +450,7 @@ solution (iif(release, slnname, "windirstat"))
         excludes
         {
             "common/tracer.cpp", -- this one gets an #include via windirstat.cpp
+            "windirstat/FileFindLinux.cpp", -- enumeration backend for sandbox/filefind only
         }
         
         vpaths
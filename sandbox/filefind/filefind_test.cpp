@@ -0,0 +1,173 @@
+// filefind_test.cpp : Enumeration test and benchmark of the Linux FileFindBackend.
+//
+// Builds without MFC against windirstat/FileFindBackend.h and
+// windirstat/FileFindLinux.cpp (see the Makefile next to this file):
+//
+//     filefind_test              checks the backend on a scratch folder
+//     filefind_test <folder>     walks the folder and prints the throughput
+//
+
+#include "FileFindBackend.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    constexpr std::uint32_t ATTRIBUTE_HIDDEN        = 0x00000002;
+    constexpr std::uint32_t ATTRIBUTE_DIRECTORY     = 0x00000010;
+    constexpr std::uint32_t ATTRIBUTE_REPARSE_POINT = 0x00000400;
+
+    int _failures = 0;
+
+    void Check(const bool condition, const char* what)
+    {
+        if (condition) return;
+        std::printf("FAILED: %s\n", what);
+        _failures++;
+    }
+
+    // Only used for the scratch folder and the command line, taken as ASCII
+    std::wstring Widen(const std::string& s)
+    {
+        return { s.begin(), s.end() };
+    }
+
+    void WriteFile(const std::string& path, const size_t bytes)
+    {
+        const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        const std::string data(bytes, 'x');
+        if (fd < 0 || write(fd, data.data(), data.size()) != static_cast<ssize_t>(data.size()))
+        {
+            std::printf("Unable to create %s\n", path.c_str());
+            std::exit(2);
+        }
+        close(fd);
+    }
+
+    // Entries of a folder by name, without "." and ".."
+    std::map<std::wstring, FileFindEntry> List(const std::string& folder, const std::wstring& pattern, const bool details)
+    {
+        std::map<std::wstring, FileFindEntry> entries;
+        const auto backend = FileFindBackend::Create();
+        if (!backend->Open(Widen(folder), pattern)) return entries;
+
+        FileFindEntry entry;
+        while (backend->Next(entry))
+        {
+            if (entry.name == L"." || entry.name == L"..") continue;
+            if (details && !entry.hasDetails) backend->LoadDetails(entry);
+            std::wstring name(entry.name);
+            entry.name = {};
+            entries.emplace(std::move(name), entry);
+        }
+        return entries;
+    }
+
+    int RunChecks()
+    {
+        char scratch[] = "/tmp/filefind_test.XXXXXX";
+        if (mkdtemp(scratch) == nullptr) return 2;
+        const std::string root = scratch;
+
+        WriteFile(root + "/empty.txt", 0);
+        WriteFile(root + "/data.bin", 12345);
+        WriteFile(root + "/.hidden", 1);
+        WriteFile(root + "/gr\xC3\xBC\xC3\x9F" "e.txt", 3); // "grüße.txt"
+        mkdir((root + "/folder").c_str(), 0755);
+        WriteFile(root + "/folder/inner.txt", 7);
+        if (symlink("folder", (root + "/link").c_str()) != 0) return 2;
+
+        const auto entries = List(root, L"", true);
+        Check(entries.size() == 6, "all entries are listed");
+        Check(entries.contains(L"grüße.txt"), "UTF-8 names are decoded");
+
+        const auto at = [&entries](const wchar_t* name) -> FileFindEntry
+        {
+            const auto it = entries.find(name);
+            return it != entries.end() ? it->second : FileFindEntry{};
+        };
+        Check(at(L"data.bin").endOfFile == 12345, "file size");
+        Check(at(L"data.bin").allocationSize >= 12345, "allocation size");
+        Check(at(L"empty.txt").endOfFile == 0, "empty file");
+        Check(at(L"data.bin").lastWriteTime > 116444736000000000ull, "time is in FILETIME units");
+        Check((at(L"folder").attributes & ATTRIBUTE_DIRECTORY) != 0, "folder attribute");
+        Check((at(L"data.bin").attributes & ATTRIBUTE_DIRECTORY) == 0, "file attribute");
+        Check((at(L"link").attributes & ATTRIBUTE_REPARSE_POINT) != 0, "symbolic links are reparse points");
+        Check((at(L".hidden").attributes & ATTRIBUTE_HIDDEN) != 0, "dot files are hidden");
+
+        const auto filtered = List(root, L"*.txt", false);
+        Check(filtered.size() == 2 && filtered.contains(L"empty.txt"), "pattern restricts the entries");
+
+        const auto single = List(root, L"data.bin", true);
+        Check(single.size() == 1 && single.begin()->second.endOfFile == 12345, "lookup of a single file");
+
+        const auto inner = List(root + "/folder", L"", true);
+        Check(inner.size() == 1 && inner.contains(L"inner.txt") && inner.at(L"inner.txt").endOfFile == 7, "sub folder");
+
+        Check(!FileFindBackend::Create()->Open(Widen(root + "/missing"), L""), "missing folder fails to open");
+
+        std::vector<std::uint8_t> sid;
+        {
+            const auto backend = FileFindBackend::Create();
+            backend->Open(Widen(root), L"data.bin");
+            FileFindEntry entry;
+            Check(backend->Next(entry) && backend->LoadOwner(entry, sid), "owner of a file");
+        }
+        Check(sid.size() == 16 && sid[0] == 1 && sid[1] == 2 && sid[7] == 22, "owner is a S-1-22-1 sid");
+        Check(sid.size() == 16 && (sid[12] | sid[13] << 8 | sid[14] << 16 | sid[15] << 24) == static_cast<int>(getuid()),
+            "owner sid carries the uid");
+
+        std::system(("rm -rf '" + root + "'").c_str());
+        std::printf(_failures == 0 ? "All checks passed\n" : "%d checks failed\n", _failures);
+        return _failures == 0 ? 0 : 1;
+    }
+
+    // Walks the folder the way the scanning threads do; sizes are only
+    // read where the backend does not deliver them with the entry
+    int RunWalk(const std::string& folder)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        unsigned long long files = 0, folders = 0, bytes = 0;
+        std::vector<std::wstring> queue = { Widen(folder) };
+        while (!queue.empty())
+        {
+            const std::wstring current = std::move(queue.back());
+            queue.pop_back();
+            const auto backend = FileFindBackend::Create();
+            if (!backend->Open(current, L"")) continue;
+
+            FileFindEntry entry;
+            while (backend->Next(entry))
+            {
+                if (entry.name == L"." || entry.name == L"..") continue;
+                if ((entry.attributes & ATTRIBUTE_DIRECTORY) != 0)
+                {
+                    folders++;
+                    queue.push_back(current + L'/' + std::wstring(entry.name));
+                    continue;
+                }
+                if (!entry.hasDetails) backend->LoadDetails(entry);
+                files++;
+                bytes += entry.endOfFile;
+            }
+        }
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("%llu files, %llu folders, %llu bytes in %.3f s (%.0f items/s)\n",
+            files, folders, bytes, seconds, (files + folders) / seconds);
+        return 0;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    return argc > 1 ? RunWalk(argv[1]) : RunChecks();
+}
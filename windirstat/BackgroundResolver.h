@@ -0,0 +1,165 @@
+// BackgroundResolver.h - Declaration of BackgroundResolver
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//
+// BackgroundResolver. Runs a slow lookup per path on the thread pool so that
+// the views can draw a placeholder instead of waiting for it. Paths are taken
+// on in batches, most recently requested first, by a few callbacks at a time.
+// A window which asked for a path gets the message once its result is there
+// and then asks again. Results are handed out once and then forgotten.
+// The lookup runs with COM initialized if NeedsCom is set, e.g. for the shell.
+//
+template <typename Result, Result (*Lookup)(const std::wstring& path), bool NeedsCom = false>
+class BackgroundResolver final
+{
+public:
+    BackgroundResolver(const UINT message, const size_t batchSize, const int maxResolvers)
+        : m_message(message), m_batchSize(batchSize), m_maxResolvers(maxResolvers) {}
+
+    // Returns true and the result if it has been found in the meantime.
+    // Otherwise the path is queued and notify receives the message once
+    // its result is known, so it can ask again.
+    bool Resolve(const std::wstring& path, const HWND notify, Result& result)
+    {
+        std::lock_guard lock(m_lock);
+        if (const auto it = m_resolved.find(path); it != m_resolved.end())
+        {
+            result = it->second;
+            m_resolved.erase(it);
+            return true;
+        }
+
+        if (!m_queued.insert(path).second)
+        {
+            return false;
+        }
+        m_pending.emplace_back(path, notify);
+
+        // Another callback is only worth it once there is a backlog
+        if (m_resolvers < m_maxResolvers && m_pending.size() > static_cast<size_t>(m_resolvers) * m_batchSize &&
+            TrySubmitThreadpoolCallback(Run, this, nullptr))
+        {
+            m_resolvers++;
+        }
+        return false;
+    }
+
+    // To be called on the message; results found until then
+    // are announced by the message already posted
+    void Acknowledge(const HWND notify)
+    {
+        std::lock_guard lock(m_lock);
+        m_notified.erase(notify);
+    }
+
+    // Forgets the queued paths and the results not picked up yet once the
+    // tree they belong to is gone; lookups still running are discarded
+    void Clear()
+    {
+        std::lock_guard lock(m_lock);
+        m_pending.clear();
+        m_pending.shrink_to_fit();
+        m_queued.clear();
+        m_resolved.clear();
+        m_generation++;
+    }
+
+private:
+    static VOID CALLBACK Run(PTP_CALLBACK_INSTANCE, const PVOID context)
+    {
+        HRESULT com = E_FAIL;
+        if constexpr (NeedsCom)
+        {
+            com = ::CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED);
+        }
+        static_cast<BackgroundResolver*>(context)->ResolvePending();
+        if (SUCCEEDED(com)) ::CoUninitialize();
+    }
+
+    // Works off the pending paths, most recently requested first since
+    // those are the rows on screen right now
+    void ResolvePending()
+    {
+        while (true)
+        {
+            std::vector<std::pair<std::wstring, HWND>> batch;
+            ULONG generation;
+            {
+                std::lock_guard lock(m_lock);
+                if (m_pending.empty())
+                {
+                    m_resolvers--;
+                    return;
+                }
+                const size_t count = min(m_pending.size(), m_batchSize);
+                batch.assign(std::make_move_iterator(m_pending.end() - static_cast<ptrdiff_t>(count)),
+                    std::make_move_iterator(m_pending.end()));
+                m_pending.resize(m_pending.size() - count);
+                generation = m_generation;
+            }
+
+            std::vector<Result> results;
+            for (const auto& [path, hwnd] : batch)
+            {
+                results.push_back(Lookup(path));
+            }
+
+            // Only one message per window is outstanding, so a window
+            // which is slow to handle it is not sent one per batch
+            std::vector<HWND> notify;
+            {
+                std::lock_guard lock(m_lock);
+                if (generation != m_generation) continue;
+                for (size_t i = 0; i < batch.size(); i++)
+                {
+                    m_resolved[batch[i].first] = results[i];
+                    m_queued.erase(batch[i].first);
+                    if (m_notified.insert(batch[i].second).second) notify.push_back(batch[i].second);
+                }
+            }
+
+            for (const HWND hwnd : notify)
+            {
+                ::PostMessage(hwnd, m_message, 0, 0);
+            }
+        }
+    }
+
+    const UINT m_message;
+    const size_t m_batchSize;  // Paths taken on by a callback at a time
+    const int m_maxResolvers;  // Callbacks running at the same time
+
+    // Paths waiting for their result and results not picked up yet
+    std::mutex m_lock;
+    std::vector<std::pair<std::wstring, HWND>> m_pending;
+    std::unordered_set<std::wstring> m_queued;
+    std::unordered_map<std::wstring, Result> m_resolved;
+    std::unordered_set<HWND> m_notified; // Have a message not handled yet
+    ULONG m_generation = 0;              // Counts Clear() calls
+    int m_resolvers = 0;
+};
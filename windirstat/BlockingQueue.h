@@ -1,22 +1,121 @@
 #pragma once
 
+#include <atomic>
 #include <deque>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <vector>
 #include <condition_variable>
 
+// Work-stealing queue used by the scanning threads. Each worker owns a slot
+// with its own small lock and item count that it pushes to and pops from; when
+// its own slot runs dry it steals from the opposite end of the other slots.
+// Nothing on the push and pop path is written by all workers: the central
+// mutex and condition variables are only used to park idle workers and to
+// coordinate suspend, resume and drain requests, and the number of parked
+// workers is only read by push() unless somebody is actually idle.
 template <typename T>
 class BlockingQueue
 {
-    std::deque<T> q;
+    struct alignas(std::hardware_destructive_interference_size) WorkerSlot
+    {
+        std::mutex x;
+        std::deque<T> q;
+        std::atomic<size_t> size = 0; // Items in q, readable without the lock
+    };
+
+    struct WorkerIdentity
+    {
+        const BlockingQueue* owner = nullptr;
+        unsigned int generation = 0;
+        unsigned int index = 0;
+    };
+
+    std::vector<std::unique_ptr<WorkerSlot>> m_slots;
+    alignas(std::hardware_destructive_interference_size) std::atomic<unsigned int> m_next_slot = 0;
+    std::atomic<unsigned int> m_next_worker = 0;
+    std::atomic<unsigned int> m_generation = 0;
+
     std::mutex x;
     std::condition_variable pushed;
     std::condition_variable waiting;
     std::condition_variable popped;
     unsigned int m_initial_workers;
-    unsigned int m_workers_waiting;
-    bool m_started = false;
-    bool m_suspended = false;
-    bool m_draining = false;
+    std::atomic<unsigned int> m_workers_waiting = 0;
+    std::atomic<bool> m_started = false;
+    std::atomic<bool> m_suspended = false;
+    std::atomic<bool> m_draining = false;
+
+    void allocate_slots()
+    {
+        m_slots.clear();
+        for (unsigned int i = 0; i < m_initial_workers; i++)
+        {
+            m_slots.emplace_back(std::make_unique<WorkerSlot>());
+        }
+    }
+
+    // Returns the slot owned by the calling worker thread; the first pop() a
+    // thread performs after a reset() assigns it a slot of its own
+    unsigned int worker_slot(bool assign)
+    {
+        thread_local WorkerIdentity identity;
+        const unsigned int generation = m_generation.load(std::memory_order_relaxed);
+        if (identity.owner != this || identity.generation != generation)
+        {
+            if (!assign)
+            {
+                // Threads that are not workers spread their items around
+                return m_next_slot.fetch_add(1, std::memory_order_relaxed) % m_initial_workers;
+            }
+
+            identity.owner = this;
+            identity.generation = generation;
+            identity.index = m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_initial_workers;
+        }
+        return identity.index;
+    }
+
+    void push_slot(unsigned int index, T const& value, bool back)
+    {
+        WorkerSlot& slot = *m_slots[index];
+        std::lock_guard lock(slot.x);
+        back ? slot.q.push_back(value) : slot.q.push_front(value);
+        slot.size.fetch_add(1);
+    }
+
+    bool try_pop(unsigned int self, bool front, T& value)
+    {
+        // Take from our own slot first and then steal from the opposite
+        // end of the other slots so owner and thief rarely collide; empty
+        // slots are passed over without taking their lock
+        for (unsigned int i = 0; i < m_initial_workers; i++)
+        {
+            WorkerSlot& slot = *m_slots[(self + i) % m_initial_workers];
+            if (slot.size.load(std::memory_order_relaxed) == 0) continue;
+            std::lock_guard lock(slot.x);
+            if (slot.q.empty()) continue;
+
+            const bool take_front = (i == 0) == front;
+            value = take_front ? slot.q.front() : slot.q.back();
+            take_front ? slot.q.pop_front() : slot.q.pop_back();
+            slot.size.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    // Number of queued items over all slots
+    size_t pending() const
+    {
+        size_t count = 0;
+        for (const auto& slot : m_slots)
+        {
+            count += slot->size.load();
+        }
+        return count;
+    }
 
 public:
     BlockingQueue(const BlockingQueue&) = delete;
@@ -25,48 +124,76 @@ public:
     BlockingQueue& operator=(BlockingQueue&&) = delete;
     ~BlockingQueue() = default;
     BlockingQueue(unsigned int workers) :
-        m_initial_workers(workers), m_workers_waiting(0) {}
+        m_initial_workers(workers > 0 ? workers : 1)
+    {
+        allocate_slots();
+    }
     BlockingQueue() : BlockingQueue(1) {}
 
     void push(T const& value, bool back = true)
     {
-        // Push another entry onto the queue
-        std::lock_guard lock(x);
+        // Push another entry onto the slot of the calling worker
         if (m_draining) return;
-        back ? q.push_back(value) : q.push_front(value);
-        pushed.notify_one();
+        const unsigned int index = worker_slot(false);
+        {
+            WorkerSlot& slot = *m_slots[index];
+            std::lock_guard lock(slot.x);
+            if (m_draining) return;
+            back ? slot.q.push_back(value) : slot.q.push_front(value);
+            slot.size.fetch_add(1);
+        }
+
+        // Only go through the central lock if somebody is parked; the
+        // sequentially consistent increment of the slot count above pairs
+        // with the one of m_workers_waiting in pop() followed by its check
+        // of the slot counts, so that either side always sees the other
+        if (m_workers_waiting.load() > 0)
+        {
+            std::lock_guard lock(x);
+            pushed.notify_one();
+        }
     }
 
     T pop(bool front = true)
     {
-        // Record the worker is waiting for an item until
-        // the queue has something in it and we are not suspended
-        std::unique_lock lock(x);
-        m_workers_waiting++;
-        waiting.notify_all();
-        pushed.wait(lock, [&]
+        const unsigned int self = worker_slot(true);
+        for (;;)
         {
-            return (!m_suspended || m_draining) && !q.empty();
-        });
+            T value;
+            if ((!m_suspended || m_draining) && try_pop(self, front, value))
+            {
+                // Worker now has something to work on
+                if (!m_started.load(std::memory_order_relaxed) && !m_draining) m_started = true;
+                if (m_draining)
+                {
+                    std::lock_guard lock(x);
+                    popped.notify_all();
+                }
+                return value;
+            }
 
-        // Worker now has something to work on so pop it off the queue
-        if (!m_draining) m_started = true;
-        m_workers_waiting--;
-        T& i = front ? q.front() : q.back();
-        front ? q.pop_front() : q.pop_back();
-        popped.notify_one();
-        return i;
+            // Record the worker is waiting for an item until
+            // the queue has something in it and we are not suspended
+            std::unique_lock lock(x);
+            m_workers_waiting.fetch_add(1);
+            waiting.notify_all();
+            pushed.wait(lock, [&]
+            {
+                return (!m_suspended || m_draining) && pending() > 0;
+            });
+            m_workers_waiting.fetch_sub(1);
+        }
     }
 
     bool wait_for_all()
     {
         // Wait for all workers threads to be
-        // waiting for more work to do 
+        // waiting for more work to do
         std::unique_lock lock(x);
         waiting.wait(lock, [&]
         {
-            return m_started && m_draining && q.empty() ||
-                !m_suspended && m_workers_waiting == m_initial_workers;
+            return m_started && m_draining && pending() == 0 ||
+                !m_suspended && pending() == 0 && m_workers_waiting == m_initial_workers;
         });
         return m_draining;
     }
@@ -84,19 +211,26 @@ public:
         }
 
         // Start draining process by feeding some special
-        // draining objects into the queue (implementation dependent)
+        // draining objects into the queue (implementation dependent);
+        // a worker that is still busy cannot add to a slot once it
+        // has been cleared since push() rechecks under the slot lock
         m_draining = true;
-        q.clear();
+        for (const auto& slot : m_slots)
+        {
+            std::lock_guard slot_lock(slot->x);
+            slot->q.clear();
+            slot->size = 0;
+        }
         for (unsigned int i = 0; i < m_initial_workers; i++)
         {
-            q.push_back(drain_object);
-            pushed.notify_one();
+            push_slot(i, drain_object, true);
         }
+        pushed.notify_all();
 
         // Wait until draining objects have been processed
         popped.wait(lock, [&]
         {
-            return q.empty();
+            return pending() == 0;
         });
         waiting.notify_all();
         return true;
@@ -104,7 +238,7 @@ public:
 
     bool has_items() const
     {
-        return !q.empty();
+        return pending() > 0;
     }
 
     bool is_suspended() const
@@ -130,20 +264,29 @@ public:
         m_suspended = false;
         m_draining = false;
         pushed.notify_all();
+        waiting.notify_all();
     }
 
     void reset(int initial_workers = -1)
     {
+        // Must only be called while no worker threads are running
         std::lock_guard lock(x);
-        q.clear();
+        if (initial_workers > 0 && static_cast<unsigned int>(initial_workers) != m_initial_workers)
+        {
+            m_initial_workers = initial_workers;
+            allocate_slots();
+        }
+        for (const auto& slot : m_slots)
+        {
+            slot->q.clear();
+            slot->size = 0;
+        }
+        m_next_slot = 0;
+        m_next_worker = 0;
+        m_generation.fetch_add(1);
         m_workers_waiting = 0;
         m_suspended = false;
         m_started = false;
         m_draining = false;
-        if (initial_workers > 0)
-        {
-            m_initial_workers = initial_workers;
-        }
     }
 };
-
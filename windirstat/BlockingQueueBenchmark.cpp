@@ -0,0 +1,150 @@
+// BlockingQueueBenchmark.cpp - Implementation of the scan queue benchmark
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "stdafx.h"
+#include "BlockingQueue.h"
+#include "BlockingQueueBenchmark.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <format>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Shape of the synthetic folder tree: every folder below
+    // the maximum depth holds this many subfolders
+    constexpr ULONG_PTR FANOUT = 8;
+    constexpr ULONG_PTR DEPTH = 7;
+
+    // The scan queue as it was before it became work-stealing: one lock and
+    // one deque shared by all workers. Only kept as the baseline to compare with.
+    template <typename T>
+    class SingleLockQueue
+    {
+        std::mutex x;
+        std::condition_variable pushed;
+        std::condition_variable waiting;
+        std::deque<T> m_queue;
+        unsigned int m_workers;
+        unsigned int m_workers_waiting = 0;
+        bool m_draining = false;
+
+    public:
+        explicit SingleLockQueue(unsigned int workers) : m_workers(workers) {}
+
+        void push(T const& value, bool back = true)
+        {
+            std::lock_guard lock(x);
+            if (m_draining) return;
+            back ? m_queue.push_back(value) : m_queue.push_front(value);
+            pushed.notify_one();
+        }
+
+        T pop(bool front = true)
+        {
+            std::unique_lock lock(x);
+            m_workers_waiting++;
+            waiting.notify_all();
+            pushed.wait(lock, [&] { return !m_queue.empty(); });
+            m_workers_waiting--;
+            T value = front ? m_queue.front() : m_queue.back();
+            front ? m_queue.pop_front() : m_queue.pop_back();
+            return value;
+        }
+
+        bool wait_for_all()
+        {
+            std::unique_lock lock(x);
+            waiting.wait(lock, [&] { return m_queue.empty() && m_workers_waiting == m_workers; });
+            return m_draining;
+        }
+
+        bool drain(T drain_object)
+        {
+            std::lock_guard lock(x);
+            m_draining = true;
+            m_queue.assign(m_workers, drain_object);
+            pushed.notify_all();
+            return true;
+        }
+    };
+
+    // Walks the synthetic tree through the given queue the way ScanItems()
+    // walks a folder: pop a folder, push its subfolders to the front and
+    // stop on the drain marker. Items are the depth plus one, zero drains.
+    template <typename Queue>
+    double RunWalk(const int threads, ULONGLONG& processed)
+    {
+        Queue queue(threads);
+        std::atomic<ULONGLONG> count = 0;
+        const auto start = std::chrono::steady_clock::now();
+        queue.push(1);
+
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; i++)
+        {
+            workers.emplace_back([&queue, &count]
+            {
+                ULONGLONG local = 0;
+                for (ULONG_PTR item = queue.pop(); item != 0; item = queue.pop())
+                {
+                    local++;
+                    if (item > DEPTH) continue;
+                    for (ULONG_PTR child = 0; child < FANOUT; child++)
+                    {
+                        queue.push(item + 1, false);
+                    }
+                }
+                count.fetch_add(local);
+            });
+        }
+
+        queue.wait_for_all();
+        queue.drain(0);
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+
+        processed = count;
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+}
+
+void RunQueueBenchmark(const int maxThreads, const std::function<void(const std::wstring&)>& report)
+{
+    report(std::format(L"Queue benchmark: fanout {}, depth {}, {} hardware threads",
+        FANOUT, DEPTH, std::thread::hardware_concurrency()));
+    for (int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        ULONGLONG stealingItems = 0;
+        ULONGLONG lockedItems = 0;
+        const double stealing = RunWalk<BlockingQueue<ULONG_PTR>>(threads, stealingItems);
+        const double locked = RunWalk<SingleLockQueue<ULONG_PTR>>(threads, lockedItems);
+        report(std::format(L"Threads {}: work-stealing {:.0f} items/s, single lock {:.0f} items/s ({:.2f}x)",
+            threads, stealingItems / stealing, lockedItems / locked, locked / stealing));
+    }
+}
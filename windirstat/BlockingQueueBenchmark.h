@@ -0,0 +1,31 @@
+// BlockingQueueBenchmark.h - Declaration of the scan queue benchmark
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+//
+// Walks a synthetic folder tree through BlockingQueue and through the single
+// lock queue it replaced, at 1 to maxThreads threads in powers of two, and
+// passes one line of results per thread count to report().
+//
+void RunQueueBenchmark(int maxThreads, const std::function<void(const std::wstring&)>& report);
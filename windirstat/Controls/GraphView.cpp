@@ -25,10 +25,112 @@
 #include "DirStatDoc.h"
 #include "DirStatView.h"
 #include "Item.h"
+#include "ExtensionTable.h"
 #include "SelectObject.h"
 #include "GraphView.h"
 #include "Localization.h"
 
+#include <algorithm>
+#include <deque>
+#include <thread>
+
+namespace
+{
+    constexpr UINT WMU_PROGRESSDRAWN = WM_USER + 100;
+
+    // Timer for the progressive treemaps, besides the one for the mouse
+    constexpr UINT_PTR ID_PROGRESS_TIMER = ID_WDS_CONTROL + 1;
+
+    // Time between two progressive treemaps while scanning
+    constexpr UINT PROGRESS_INTERVAL_MS = 3000;
+
+    // The copy of the tree does not go into directories smaller than this many pixels
+    constexpr double PROGRESS_MIN_AREA = 64;
+
+    // and stops growing at this many nodes
+    constexpr size_t PROGRESS_MAX_NODES = 100000;
+
+    //
+    // CProgressItem. Node of the copy of the tree a progressive treemap is
+    // drawn from, so that the treemap never reads the tree the scan changes.
+    //
+    class CProgressItem final : public CTreemap::Item
+    {
+    public:
+        bool TmiIsLeaf() const override { return m_children.empty(); }
+        CRect TmiGetRectangle() const override { return m_rect; }
+        void TmiSetRectangle(const CRect& rc) override { m_rect = rc; }
+        COLORREF TmiGetGraphColor() const override { return m_color; }
+        int TmiGetChildCount() const override { return static_cast<int>(m_children.size()); }
+        CTreemap::Item* TmiGetChild(const int c) const override { return m_children[c]; }
+        ULONGLONG TmiGetSize() const override { return m_size; }
+
+        std::vector<CProgressItem*> m_children;
+        ULONGLONG m_size = 0;
+        COLORREF m_color = 0;
+        CRect m_rect;
+    };
+
+    // Copies the tree below root as far as it is worth drawing into the given
+    // number of pixels. Directories a scan thread is adding to right now are
+    // not waited for but drawn as one block, just like the small ones. The
+    // extension colors are not known before the scan is done, so the files
+    // are colored by their extension id only.
+    std::deque<CProgressItem> CopyTree(const CItem* root, const double area, const std::vector<COLORREF>& palette)
+    {
+        std::deque<CProgressItem> nodes(1);
+        std::vector<std::pair<const CItem*, CProgressItem*>> pending = { { root, &nodes.front() } };
+        const double pixelsPerByte = area / max(1ull, root->GetSize());
+
+        std::vector<CItem*> children;
+        for (size_t i = 0; i < pending.size(); i++)
+        {
+            const auto [item, copy] = pending[i];
+            copy->m_size = item->GetSize();
+            copy->m_color = palette.back();
+
+            if (item->IsType(IT_FILE))
+            {
+                copy->m_color = palette[item->GetExtensionId() % (palette.size() - 1)];
+                continue;
+            }
+            if (item->IsType(IT_FREESPACE | IT_UNKNOWN))
+            {
+                copy->m_color = item->TmiGetGraphColor();
+                continue;
+            }
+            if (copy->m_size * pixelsPerByte < PROGRESS_MIN_AREA || nodes.size() >= PROGRESS_MAX_NODES ||
+                !item->TryCopyChildren(children))
+            {
+                continue;
+            }
+
+            for (const auto& child : children)
+            {
+                if (child->GetSize() == 0) continue;
+                copy->m_children.push_back(&nodes.emplace_back());
+                pending.emplace_back(child, copy->m_children.back());
+            }
+        }
+
+        // The totals published by the scan threads lag behind, so they are
+        // summed up again from the copied children, which are also sorted
+        // by size like the treemap expects
+        for (auto node = nodes.rbegin(); node != nodes.rend(); ++node)
+        {
+            if (node->m_children.empty()) continue;
+            node->m_size = 0;
+            for (const auto& child : node->m_children)
+            {
+                node->m_size += child->m_size;
+            }
+            std::ranges::sort(node->m_children, [](const auto* a, const auto* b) { return a->m_size > b->m_size; });
+        }
+
+        return nodes;
+    }
+}
+
 IMPLEMENT_DYNCREATE(CGraphView, CView)
 
 BEGIN_MESSAGE_MAP(CGraphView, CView)
@@ -39,6 +141,7 @@ BEGIN_MESSAGE_MAP(CGraphView, CView)
     ON_WM_MOUSEMOVE()
     ON_WM_DESTROY()
     ON_WM_TIMER()
+    ON_MESSAGE(WMU_PROGRESSDRAWN, OnProgressDrawn)
 END_MESSAGE_MAP()
 
 CGraphView::CGraphView()
@@ -48,6 +151,7 @@ CGraphView::CGraphView()
     m_size.cx                = m_size.cy       = 0;
     m_dimmedSize.cx          = m_dimmedSize.cy = 0;
     m_timer                  = 0;
+    m_progress               = std::make_shared<ProgressState>();
 }
 
 void CGraphView::SuspendRecalculationDrawing(bool suspend)
@@ -59,6 +163,121 @@ void CGraphView::SuspendRecalculationDrawing(bool suspend)
     }
 }
 
+void CGraphView::DetachItems()
+{
+    m_treemap.DetachItems();
+}
+
+void CGraphView::StartProgressiveDrawing()
+{
+    if (!COptions::TreeMapProgressive)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard lock(m_progress->walk);
+        m_progress->allowed = true;
+    }
+    {
+        std::lock_guard lock(m_progress->result);
+        m_progress->hwnd = m_hWnd;
+    }
+    SetTimer(ID_PROGRESS_TIMER, PROGRESS_INTERVAL_MS, nullptr);
+}
+
+void CGraphView::StopProgressiveDrawing()
+{
+    KillTimer(ID_PROGRESS_TIMER);
+
+    std::lock_guard lock(m_progress->walk);
+    m_progress->allowed = false;
+    m_progress->generation++;
+}
+
+// Copies and draws the tree on a thread of its own. The scan threads are
+// never waited for; they only wait for the copy of the children of a
+// directory when they are adding to it at the same time.
+//
+void CGraphView::StartProgressiveTreemap()
+{
+    CRect rc;
+    GetClientRect(rc);
+    if (m_progress->busy || !m_showTreemap || rc.IsRectEmpty() || GetDocument()->GetZoomItem() == nullptr)
+    {
+        return;
+    }
+    m_progress->busy = true;
+
+    CColorRefRArray colors;
+    CTreemap::GetDefaultPalette(colors);
+    std::vector<COLORREF> palette(colors.GetData(), colors.GetData() + colors.GetSize());
+
+    // The root belongs to the scan running now; only this thread changes
+    // the generation, so it can be read here without the lock
+    std::thread([state = m_progress, root = GetDocument()->GetZoomItem(), generation = m_progress->generation,
+        size = rc.Size(), options = COptions::TreemapOptions, palette = std::move(palette)]
+    {
+        std::deque<CProgressItem> nodes;
+        {
+            // The scan may have finished and freed the root in the meantime
+            std::lock_guard lock(state->walk);
+            if (state->allowed && state->generation == generation)
+            {
+                nodes = CopyTree(root, static_cast<double>(size.cx) * size.cy, palette);
+            }
+        }
+
+        if (!nodes.empty() && nodes.front().m_size > 0)
+        {
+            const HDC screen = ::GetDC(nullptr);
+            const HBITMAP bitmap = ::CreateCompatibleBitmap(screen, size.cx, size.cy);
+            CDC dc;
+            dc.Attach(::CreateCompatibleDC(screen));
+            ::ReleaseDC(nullptr, screen);
+
+            const HGDIOBJ old = dc.SelectObject(bitmap);
+            CTreemap treemap;
+            treemap.DrawTreemap(&dc, CRect(CPoint(0, 0), size), &nodes.front(), &options);
+            dc.SelectObject(old);
+            dc.DeleteDC();
+
+            std::lock_guard lock(state->result);
+            if (state->bitmap != nullptr) ::DeleteObject(state->bitmap);
+            state->bitmap = bitmap;
+            state->size = size;
+            state->bitmapGeneration = generation;
+            if (state->hwnd != nullptr) ::PostMessage(state->hwnd, WMU_PROGRESSDRAWN, 0, 0);
+        }
+
+        state->busy = false;
+    }).detach();
+}
+
+LRESULT CGraphView::OnProgressDrawn(WPARAM, LPARAM)
+{
+    std::lock_guard lock(m_progress->result);
+    if (m_progress->bitmap == nullptr)
+    {
+        return 0;
+    }
+
+    // Results of an earlier scan or arriving after the exact treemap are dropped
+    const HBITMAP bitmap = m_progress->bitmap;
+    m_progress->bitmap = nullptr;
+    if (m_progress->bitmapGeneration != m_progress->generation || GetDocument()->IsRootDone())
+    {
+        ::DeleteObject(bitmap);
+        return 0;
+    }
+
+    m_progressBitmap.DeleteObject();
+    m_progressBitmap.Attach(bitmap);
+    m_progressSize = m_progress->size;
+    Invalidate();
+    return 0;
+}
+
 bool CGraphView::IsShowTreemap() const
 {
     return m_showTreemap;
@@ -130,6 +349,8 @@ void CGraphView::OnDraw(CDC* pDC)
     const CItem* root = GetDocument()->GetRootItem();
     if (root != nullptr && root->IsDone())
     {
+        m_progressBitmap.DeleteObject();
+
         if (m_recalculationDrawingSuspended || !m_showTreemap)
         {
             // TODO: draw something interesting, e.g. outline of the first level.
@@ -159,6 +380,7 @@ void CGraphView::OnDraw(CDC* pDC)
                 }
 
                 m_treemap.DrawTreemap(&dcmem, rc, GetDocument()->GetZoomItem(), &COptions::TreemapOptions);
+                m_extensionRectsValid = false;
 
                 // Cause OnIdle() to be called once.
                 ::PostThreadMessage(::GetCurrentThreadId(), WM_NULL, 0, 0);
@@ -171,12 +393,29 @@ void CGraphView::OnDraw(CDC* pDC)
             DrawHighlights(pDC);
         }
     }
+    else if (m_showTreemap && m_progressBitmap.m_hObject != nullptr)
+    {
+        DrawProgressive(pDC);
+    }
     else
     {
         DrawEmptyView(pDC);
     }
 }
 
+void CGraphView::DrawProgressive(CDC* pDC)
+{
+    CRect rc;
+    GetClientRect(rc);
+
+    // The view may have been resized since
+    CDC dcmem;
+    dcmem.CreateCompatibleDC(pDC);
+    CSelectObject sobmp(&dcmem, &m_progressBitmap);
+    pDC->SetStretchBltMode(COLORONCOLOR);
+    pDC->StretchBlt(0, 0, rc.Width(), rc.Height(), &dcmem, 0, 0, m_progressSize.cx, m_progressSize.cy, SRCCOPY);
+}
+
 void CGraphView::DrawZoomFrame(CDC* pdc, CRect& rc)
 {
     constexpr int w = 4;
@@ -215,44 +454,50 @@ void CGraphView::DrawHighlights(CDC* pdc)
 
 void CGraphView::DrawHighlightExtension(CDC* pdc)
 {
-    CWaitCursor wc;
-
     CPen pen(PS_SOLID, 1, COptions::TreeMapHighlightColor);
     CSelectObject sopen(pdc, &pen);
     CSelectStockObject sobrush(pdc, NULL_BRUSH);
-    RecurseHighlightExtension(pdc, GetDocument()->GetZoomItem());
-}
 
-void CGraphView::RecurseHighlightExtension(CDC* pdc, const CItem* item)
-{
-    CRect rc(item->TmiGetRectangle());
-    if (rc.Width() <= 0 || rc.Height() <= 0)
+    // Nothing to highlight if no file carries this extension
+    ULONG extension;
+    if (!ExtensionTable::Find(GetDocument()->GetHighlightExtension(), extension))
     {
         return;
     }
 
-    if (item->TmiIsLeaf())
+    if (!m_extensionRectsValid)
     {
-        if (item->IsType(IT_FILE) && item->GetExtension().CompareNoCase(GetDocument()->GetHighlightExtension()) == 0)
-        {
-            RenderHighlightRectangle(pdc, rc);
-        }
+        BuildExtensionRects();
     }
-    else
+
+    const auto rects = m_extensionRects.find(extension);
+    if (rects == m_extensionRects.end())
+    {
+        return;
+    }
+    for (CRect rc : rects->second)
+    {
+        RenderHighlightRectangle(pdc, rc);
+    }
+}
+
+// Sorts the rectangles of the files in the current treemap by extension,
+// so that highlighting another extension does not have to walk the tree.
+//
+void CGraphView::BuildExtensionRects()
+{
+    CWaitCursor wc;
+
+    m_extensionRects.clear();
+    m_treemap.EnumerateLeaves(GetDocument()->GetZoomItem(), [this](CTreemap::Item* leaf, const CRect& rc)
     {
-        for (const auto& child : item->GetChildren())
+        const auto item = static_cast<const CItem*>(leaf);
+        if (item->IsType(IT_FILE))
         {
-            if (child->TmiGetSize() == 0)
-            {
-                break;
-            }
-            if (child->TmiGetRectangle().left == -1)
-            {
-                break;
-            }
-            RecurseHighlightExtension(pdc, child);
+            m_extensionRects[item->GetExtensionId()].push_back(rc);
         }
-    }
+    });
+    m_extensionRectsValid = true;
 }
 
 void CGraphView::DrawSelection(CDC* pdc)
@@ -396,6 +641,10 @@ void CGraphView::EmptyView()
     {
         m_dimmed.DeleteObject();
     }
+
+    m_progressBitmap.DeleteObject();
+    m_extensionRects.clear();
+    m_extensionRectsValid = false;
 }
 
 void CGraphView::OnSetFocus(CWnd* /*pOldWnd*/)
@@ -407,6 +656,8 @@ void CGraphView::OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint)
 {
     if (!GetDocument()->IsRootDone())
     {
+        // Keep the layout: a finished refresh may only need to patch it;
+        // the refresh detached it from the items it frees
         Inactivate();
     }
 
@@ -414,6 +665,7 @@ void CGraphView::OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint)
     {
     case HINT_NEWROOT:
         {
+            m_treemap.InvalidateLayout();
             EmptyView();
             CView::OnUpdate(pSender, lHint, pHint);
         }
@@ -437,6 +689,7 @@ void CGraphView::OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint)
 
     case HINT_TREEMAPSTYLECHANGED:
         {
+            // The treemap only redoes the layout if the new options require it
             Inactivate();
             CView::OnUpdate(pSender, lHint, pHint);
         }
@@ -444,6 +697,13 @@ void CGraphView::OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint)
 
     case HINT_NULL:
         {
+            // A finished refresh passes the items it changed
+            const auto items = reinterpret_cast<const std::vector<CItem*>*>(pHint);
+            if (items == nullptr || !m_treemap.UpdateItems(GetDocument()->GetZoomItem(), { items->begin(), items->end() }))
+            {
+                m_treemap.InvalidateLayout();
+            }
+            m_extensionRectsValid = false;
             CView::OnUpdate(pSender, lHint, pHint);
         }
         break;
@@ -490,11 +750,23 @@ void CGraphView::OnDestroy()
     }
     m_timer = 0;
 
+    StopProgressiveDrawing();
+    {
+        std::lock_guard lock(m_progress->result);
+        m_progress->hwnd = nullptr;
+    }
+
     CView::OnDestroy();
 }
 
-void CGraphView::OnTimer(UINT_PTR /*nIDEvent*/)
+void CGraphView::OnTimer(UINT_PTR nIDEvent)
 {
+    if (nIDEvent == ID_PROGRESS_TIMER)
+    {
+        StartProgressiveTreemap();
+        return;
+    }
+
     CPoint point;
     GetCursorPos(&point);
     ScreenToClient(&point);
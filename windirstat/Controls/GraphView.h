@@ -23,6 +23,11 @@
 
 #include "TreeMap.h"
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
 class CDirStatDoc;
 class CItem;
 
@@ -45,11 +50,44 @@ public:
     }
 
     void SuspendRecalculationDrawing(bool suspend);
+
+    // Must be called before a refresh frees items of the tree; hit testing
+    // is off until OnUpdate() has patched or dropped the layout
+    void DetachItems();
     bool IsShowTreemap() const;
     void ShowTreemap(bool show);
     void DrawEmptyView();
 
+    // While the tree is being scanned, draws an approximate treemap from the
+    // partial totals every few seconds. Stopping waits until the tree is no
+    // longer read, after that it may be changed freely.
+    void StartProgressiveDrawing();
+    void StopProgressiveDrawing();
+
 protected:
+    //
+    // ProgressState. Shared with the thread drawing a progressive treemap,
+    // which may still be running when the view is gone.
+    //
+    struct ProgressState
+    {
+        ~ProgressState()
+        {
+            if (bitmap != nullptr) ::DeleteObject(bitmap);
+        }
+
+        std::mutex walk;            // Held while the tree is read
+        bool allowed = false;       // Whether the tree may be read
+        ULONG generation = 0;       // Counts the scans, so late results can be told apart
+        std::atomic<bool> busy = false;
+
+        std::mutex result;
+        HWND hwnd = nullptr;        // Who is told when a treemap is finished
+        HBITMAP bitmap = nullptr;   // The last finished treemap
+        CSize size;
+        ULONG bitmapGeneration = 0;
+    };
+
     BOOL PreCreateWindow(CREATESTRUCT& cs) override;
     void OnUpdate(CView* pSender, LPARAM lHint, CObject* pHint) override;
     void OnDraw(CDC* pDC) override;
@@ -57,12 +95,14 @@ protected:
     void Inactivate();
     void EmptyView();
     void DrawEmptyView(CDC* pDC);
+    void DrawProgressive(CDC* pDC);
+    void StartProgressiveTreemap();
 
     void DrawZoomFrame(CDC* pdc, CRect& rc);
     void DrawHighlights(CDC* pdc);
 
     void DrawHighlightExtension(CDC* pdc);
-    void RecurseHighlightExtension(CDC* pdc, const CItem* item);
+    void BuildExtensionRects();
 
     void DrawSelection(CDC* pdc);
 
@@ -77,6 +117,11 @@ protected:
     CSize m_dimmedSize;            // Size of bitmap m_dimmed
     CBitmap m_dimmed;              // Dimmed view. Used during refresh to avoid the ooops-effect.
     UINT_PTR m_timer;              // We need a timer to realize when the mouse left our window.
+    std::unordered_map<ULONG, std::vector<CRect>> m_extensionRects; // Rectangles of the files drawn, by extension
+    bool m_extensionRectsValid = false; // False, if m_extensionRects must be rebuilt for the current treemap
+    std::shared_ptr<ProgressState> m_progress; // Progressive treemaps while scanning
+    CBitmap m_progressBitmap;      // The last one of them
+    CSize m_progressSize;          // Size of bitmap m_progressBitmap
 
     DECLARE_MESSAGE_MAP()
     afx_msg void OnSize(UINT nType, int cx, int cy);
@@ -86,6 +131,7 @@ protected:
     afx_msg void OnMouseMove(UINT nFlags, CPoint point);
     afx_msg void OnDestroy();
     afx_msg void OnTimer(UINT_PTR nIDEvent);
+    afx_msg LRESULT OnProgressDrawn(WPARAM, LPARAM);
 };
 
 
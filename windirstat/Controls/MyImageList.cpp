@@ -23,12 +23,53 @@
 #include "WinDirStat.h"
 #include "MyImageList.h"
 #include "SmartPointer.h"
+#include "BackgroundResolver.h"
+
+#include <shlwapi.h>
+#include <string>
+
+#pragma comment(lib,"shlwapi.lib")
+
+namespace
+{
+    // Extensions whose files usually carry icons of their own
+    constexpr LPCWSTR PER_FILE_EXTENSIONS[] = { L".exe", L".ico", L".cur", L".ani", L".lnk",
+        L".url", L".scr", L".cpl", L".appref-ms", L".library-ms" };
+
+    bool IsIconPerFile(LPCWSTR ext)
+    {
+        for (const LPCWSTR perFile : PER_FILE_EXTENSIONS)
+        {
+            if (_wcsicmp(ext, perFile) == 0) return true;
+        }
+
+        // Types registered with "%1" as their icon show the icon of the file itself
+        WCHAR icon[MAX_PATH];
+        DWORD length = _countof(icon);
+        return SUCCEEDED(::AssocQueryString(ASSOCF_NONE, ASSOCSTR_DEFAULTICON, ext, nullptr, icon, &length)) &&
+            wcscmp(icon, L"%1") == 0;
+    }
+
+    // Only the index into the system image list is asked for, which spares
+    // creating an icon; only the message thread adds it to our list
+    std::pair<HIMAGELIST, int> QueryIcon(const std::wstring& path)
+    {
+        SHFILEINFO sfi = { nullptr };
+        const auto hil = reinterpret_cast<HIMAGELIST>(::SHGetFileInfo(path.c_str(), 0, &sfi, sizeof(sfi),
+            SHGFI_SYSICONINDEX | SHGFI_SMALLICON));
+        return { hil, sfi.iIcon };
+    }
+
+    // Icons of the rows on screen, 32 paths at a time by up to 2 callbacks
+    BackgroundResolver<std::pair<HIMAGELIST, int>, QueryIcon, true> _resolver(CMyImageList::WM_IMAGESRESOLVED, 32, 2);
+}
 
 CMyImageList::CMyImageList()
     : m_junctionProtected(-1)
       , m_freeSpaceImage(-1)
       , m_unknownImage(-1)
       , m_emptyImage(-1)
+      , m_folderImage(-1)
       , m_junctionImage(-1)
 {
 }
@@ -77,22 +118,51 @@ short CMyImageList::cacheIcon(LPCWSTR path, UINT flags, CStringW* psTypeName)
         return getEmptyImage();
     }
 
+    if (sfi.hIcon != nullptr)
+    {
+        ::DestroyIcon(sfi.hIcon);
+    }
+
     if (psTypeName != nullptr)
     {
         *psTypeName = sfi.szTypeName;
     }
 
+    return cacheSystemIcon(hil, sfi.iIcon);
+}
+
+// Returns our index of an icon in the system image list
+short CMyImageList::cacheSystemIcon(HIMAGELIST hil, int icon)
+{
+    if (hil == nullptr)
+    {
+        return getEmptyImage();
+    }
+
     short i;
-    if (!m_indexMap.Lookup(sfi.iIcon, i)) // part of the system image list?
+    if (!m_indexMap.Lookup(icon, i)) // part of the system image list?
     {
         CImageList* sil = CImageList::FromHandle(hil); // does not have to be destroyed
-        i = static_cast<short>(this->Add(sil->ExtractIcon(sfi.iIcon)));
-        m_indexMap.SetAt(sfi.iIcon, i);
+        const HICON hicon = sil->ExtractIcon(icon);
+        i = static_cast<short>(this->Add(hicon));
+        ::DestroyIcon(hicon);
+        m_indexMap.SetAt(icon, i);
     }
 
     return i;
 }
 
+const CMyImageList::EXTENSIONIMAGE& CMyImageList::getExtensionImage(LPCWSTR ext)
+{
+    const auto [it, added] = m_extensionImages.try_emplace(ext);
+    if (added)
+    {
+        it->second.image = cacheIcon(ext, SHGFI_USEFILEATTRIBUTES);
+        it->second.perFile = IsIconPerFile(ext);
+    }
+    return it->second;
+}
+
 short CMyImageList::getMyComputerImage()
 {
     SmartPointer<LPITEMIDLIST> pidl(CoTaskMemFree);
@@ -137,6 +207,47 @@ short CMyImageList::getFileImage(LPCWSTR path)
     return cacheIcon(path, 0);
 }
 
+// Image for a file (ext given) or folder in the tree list. Where the shell
+// icon only depends on the extension it comes from a cache by extension.
+// Otherwise it is looked up on the thread pool and false is returned with
+// the type or folder icon standing in until notify receives
+// WM_IMAGESRESOLVED and asks again.
+//
+bool CMyImageList::getItemImage(const CStringW& path, LPCWSTR ext, HWND notify, short& image)
+{
+    const EXTENSIONIMAGE* type = ext != nullptr ? &getExtensionImage(ext) : nullptr;
+    if (type != nullptr && !type->perFile)
+    {
+        image = type->image;
+        return true;
+    }
+
+    if (type == nullptr && m_folderImage == -1)
+    {
+        m_folderImage = getFolderImage();
+    }
+
+    std::pair<HIMAGELIST, int> icon;
+    if (!_resolver.Resolve(path.GetString(), notify, icon))
+    {
+        image = type != nullptr ? type->image : m_folderImage;
+        return false;
+    }
+
+    image = cacheSystemIcon(icon.first, icon.second);
+    return true;
+}
+
+void CMyImageList::acknowledgeResolved(HWND notify)
+{
+    _resolver.Acknowledge(notify);
+}
+
+void CMyImageList::clearPending()
+{
+    _resolver.Clear();
+}
+
 short CMyImageList::getExtImageAndDescription(LPCWSTR ext, CStringW& description)
 {
     return cacheIcon(ext, SHGFI_USEFILEATTRIBUTES, &description);
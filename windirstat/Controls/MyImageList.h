@@ -21,6 +21,9 @@
 
 #pragma once
 
+#include <string>
+#include <unordered_map>
+
 //
 // CMyImageList. Both CDirStatView and CTypeView use this central
 // image list. It caches the system image list images as needed,
@@ -32,6 +35,8 @@ class CMyImageList final : public CImageList
     static constexpr UINT WDS_SHGFI_DEFAULTS = SHGFI_SYSICONINDEX | SHGFI_SMALLICON | SHGFI_ICON;
 
 public:
+    static constexpr UINT WM_IMAGESRESOLVED = WM_APP + 2; // Posted to controls, so not WM_USER based
+
     CMyImageList();
     ~CMyImageList() override = default;
 
@@ -43,6 +48,15 @@ public:
     short getJunctionProtectedImage() const;
     short getFolderImage();
     short getFileImage(LPCWSTR path);
+    bool getItemImage(const CStringW& path, LPCWSTR ext, HWND notify, short& image);
+
+    // To be called on WM_IMAGESRESOLVED; icons found until then
+    // are announced by the message already posted
+    void acknowledgeResolved(HWND notify);
+
+    // Forgets the queued paths and the icons not picked up yet once the
+    // tree they belong to is gone; lookups still running are discarded
+    void clearPending();
     short getExtImageAndDescription(LPCWSTR ext, CStringW& description);
 
     short getFreeSpaceImage() const;
@@ -50,16 +64,26 @@ public:
     short getEmptyImage() const;
 
 protected:
+    struct EXTENSIONIMAGE
+    {
+        short image;  // Icon of the file type
+        bool perFile; // Whether files of this type may have icons of their own
+    };
+
     short cacheIcon(LPCWSTR path, UINT flags, CStringW* psTypeName = nullptr);
+    short cacheSystemIcon(HIMAGELIST hil, int icon);
+    const EXTENSIONIMAGE& getExtensionImage(LPCWSTR ext);
     static CStringW getADriveSpec();
     void addCustomImages();
 
     CMap<int, int, short, short> m_indexMap; // system image list index -> our index
+    std::unordered_map<std::wstring, EXTENSIONIMAGE> m_extensionImages; // extension -> type icon
 
     short m_junctionProtected; // <Files>
     short m_freeSpaceImage;   // <Free Space>
     short m_unknownImage;     // <Unknown>
     short m_emptyImage;       // For items whose image cannot be found
+    short m_folderImage;      // Stands in for folders until their own image is known
 
     // Junction point
     short m_junctionImage;
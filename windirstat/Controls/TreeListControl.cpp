@@ -99,7 +99,7 @@ CStringW CTreeListItem::GetText(int /*subitem*/) const
 int CTreeListItem::GetImage() const
 {
     ASSERT(IsVisible());
-    if (m_vi->image == -1)
+    if (m_vi->image == -1 || m_vi->imagePending)
     {
         m_vi->image = GetImageToCache();
     }
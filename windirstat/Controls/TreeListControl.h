@@ -23,6 +23,7 @@
 
 #include "OwnerDrawnListControl.h"
 #include "pacman.h"
+#include "OwnerTable.h"
 
 #include <vector>
 #include <shared_mutex>
@@ -51,15 +52,18 @@ class CTreeListItem : public COwnerDrawnListItem
         CPacman pacman;
         CRect rcPlusMinus;    // Coordinates of the little +/- rectangle, relative to the upper left corner of the item.
         CRect rcTitle;        // Coordinates of the label, relative to the upper left corner of the item.
-        CStringW owner;       // Owner of file or folder
+        ULONG owner;          // Id of the owner in the OwnerTable, OwnerTable::Pending as long as not known.
         short image;          // -1 as long as not needed, >= 0: valid index in MyImageList.
         unsigned char indent; // 0 for the root item, 1 for its children, and so on.
         bool isExpanded;      // Whether item is expanded.
+        bool imagePending;    // Whether image is a placeholder until the real one is known.
 
         VISIBLEINFO(unsigned char iIndent)
-            : image(-1)
+            : owner(OwnerTable::Pending)
+              , image(-1)
               , indent(iIndent)
               , isExpanded(false)
+              , imagePending(false)
         {
         }
     };
@@ -23,6 +23,24 @@
 #include "SelectObject.h"
 #include "TreeMap.h"
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <functional>
+#include <iterator>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#define CUSHION_SIMD
+#endif
+
+#ifndef PF_AVX2_INSTRUCTIONS_AVAILABLE
+#define PF_AVX2_INSTRUCTIONS_AVAILABLE 40 // Missing from older SDKs
+#endif
+
 #define BGR(b,g,r)          ((COLORREF)(((BYTE)(b)|((WORD)((BYTE)(g))<<8))|(((DWORD)(BYTE)(r))<<16)))
 
 // I define the "brightness" of an rgb value as (r+b+g)/3/255.
@@ -33,6 +51,350 @@
 
 static constexpr double PALETTE_BRIGHTNESS = 0.6;
 
+namespace
+{
+    // Everything needed to shade one row of a cushion
+    struct CushionRow
+    {
+        double nxScale;   // Surface normal: nx = nxScale * (ix + 0.5) + nxOffset
+        double nxOffset;
+        double ny;        // Constant along the row
+        double lx;        // Light source
+        double ly;
+        double lz;
+        double ambient;
+        double shading;
+        double factor;    // Brightness relative to PALETTE_BRIGHTNESS
+        double colR;
+        double colG;
+        double colB;
+        bool normalize;   // Whether colors may exceed 255 and need CColorSpace::NormalizeColor()
+    };
+
+    using CushionRowKernel = void (*)(const CushionRow& row, int left, int right, COLORREF* out);
+
+    COLORREF MakeCushionColor(const CushionRow& row, const double pixel)
+    {
+        // Make color value
+        int red   = static_cast<int>(row.colR * pixel);
+        int green = static_cast<int>(row.colG * pixel);
+        int blue  = static_cast<int>(row.colB * pixel);
+
+        CColorSpace::NormalizeColor(red, green, blue);
+
+        return BGR(blue, green, red);
+    }
+
+    // Brightness of a pixel including the brightness factor
+    double CushionPixel(const CushionRow& row, const int ix)
+    {
+        const double nx = row.nxScale * (ix + 0.5) + row.nxOffset;
+        double cosa     = (nx * row.lx + row.ny * row.ly + row.lz) / sqrt(nx * nx + row.ny * row.ny + 1.0);
+        if (cosa > 1.0)
+        {
+            cosa = 1.0;
+        }
+
+        double pixel = row.shading * cosa;
+        if (pixel < 0)
+        {
+            pixel = 0;
+        }
+
+        pixel += row.ambient;
+        ASSERT(pixel <= 1.0);
+
+        // Now, pixel is the brightness of the pixel, 0...1.0.
+
+        // Apply contrast.
+        // Not implemented.
+        // Costs performance and nearly the same effect can be
+        // made width the m_options->ambientLight parameter.
+        // pixel = pow(pixel, m_options->contrast);
+
+        // Apply "brightness"
+        return pixel * row.factor;
+    }
+
+    // Reference implementation; the vector kernels stay within +-1 of it per channel
+    void ShadeCushionRowScalar(const CushionRow& row, const int left, const int right, COLORREF* out)
+    {
+        for (int ix = left; ix < right; ix++)
+        {
+            out[ix] = MakeCushionColor(row, CushionPixel(row, ix));
+        }
+    }
+
+#ifdef CUSHION_SIMD
+    //
+    // Sse2, Avx2. The handful of vector operations the cushion kernel needs,
+    // so that the kernel itself is written once for all instruction sets.
+    //
+    struct Sse2
+    {
+        using Float = __m128;
+        using Int = __m128i;
+        static constexpr int Width = 4;
+
+        static Float Set(const float v) { return _mm_set1_ps(v); }
+        static Float Ramp() { return _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f); }
+        static Float Add(const Float a, const Float b) { return _mm_add_ps(a, b); }
+        static Float Sub(const Float a, const Float b) { return _mm_sub_ps(a, b); }
+        static Float Mul(const Float a, const Float b) { return _mm_mul_ps(a, b); }
+        static Float Min(const Float a, const Float b) { return _mm_min_ps(a, b); }
+        static Float Max(const Float a, const Float b) { return _mm_max_ps(a, b); }
+        static Float RSqrt(const Float a) { return _mm_rsqrt_ps(a); }
+        static Int Truncate(const Float a) { return _mm_cvttps_epi32(a); }
+        static Float ToFloat(const Int a) { return _mm_cvtepi32_ps(a); }
+        static int Outside(const Float a, const float low, const float high)
+        {
+            return _mm_movemask_ps(_mm_or_ps(_mm_cmplt_ps(a, Set(low)), _mm_cmpgt_ps(a, Set(high))));
+        }
+
+        static Int SetInt(const int v) { return _mm_set1_epi32(v); }
+        static Int AddInt(const Int a, const Int b) { return _mm_add_epi32(a, b); }
+        static Int SubInt(const Int a, const Int b) { return _mm_sub_epi32(a, b); }
+        static Int Half(const Int a) { return _mm_srai_epi32(a, 1); }
+        static Int Greater(const Int a, const Int b) { return _mm_cmpgt_epi32(a, b); }
+        static Int Or(const Int a, const Int b) { return _mm_or_si128(a, b); }
+        static bool Any(const Int mask) { return _mm_movemask_epi8(mask) != 0; }
+        static Int AndNot(const Int mask, const Int a) { return _mm_andnot_si128(mask, a); }
+        static Int Select(const Int mask, const Int a, const Int b)
+        {
+            return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+        }
+        static void Store(COLORREF* out, const Int red, const Int green, const Int blue)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                _mm_or_si128(blue, _mm_or_si128(_mm_slli_epi32(green, 8), _mm_slli_epi32(red, 16))));
+        }
+    };
+
+    struct Avx2
+    {
+        using Float = __m256;
+        using Int = __m256i;
+        static constexpr int Width = 8;
+
+        static Float Set(const float v) { return _mm256_set1_ps(v); }
+        static Float Ramp() { return _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f); }
+        static Float Add(const Float a, const Float b) { return _mm256_add_ps(a, b); }
+        static Float Sub(const Float a, const Float b) { return _mm256_sub_ps(a, b); }
+        static Float Mul(const Float a, const Float b) { return _mm256_mul_ps(a, b); }
+        static Float Min(const Float a, const Float b) { return _mm256_min_ps(a, b); }
+        static Float Max(const Float a, const Float b) { return _mm256_max_ps(a, b); }
+        static Float RSqrt(const Float a) { return _mm256_rsqrt_ps(a); }
+        static Int Truncate(const Float a) { return _mm256_cvttps_epi32(a); }
+        static Float ToFloat(const Int a) { return _mm256_cvtepi32_ps(a); }
+        static int Outside(const Float a, const float low, const float high)
+        {
+            return _mm256_movemask_ps(_mm256_or_ps(_mm256_cmp_ps(a, Set(low), _CMP_LT_OQ),
+                _mm256_cmp_ps(a, Set(high), _CMP_GT_OQ)));
+        }
+
+        static Int SetInt(const int v) { return _mm256_set1_epi32(v); }
+        static Int AddInt(const Int a, const Int b) { return _mm256_add_epi32(a, b); }
+        static Int SubInt(const Int a, const Int b) { return _mm256_sub_epi32(a, b); }
+        static Int Half(const Int a) { return _mm256_srai_epi32(a, 1); }
+        static Int Greater(const Int a, const Int b) { return _mm256_cmpgt_epi32(a, b); }
+        static Int Or(const Int a, const Int b) { return _mm256_or_si256(a, b); }
+        static bool Any(const Int mask) { return _mm256_movemask_epi8(mask) != 0; }
+        static Int AndNot(const Int mask, const Int a) { return _mm256_andnot_si256(mask, a); }
+        static Int Select(const Int mask, const Int a, const Int b) { return _mm256_blendv_epi8(b, a, mask); }
+        static void Store(COLORREF* out, const Int red, const Int green, const Int blue)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out),
+                _mm256_or_si256(blue, _mm256_or_si256(_mm256_slli_epi32(green, 8), _mm256_slli_epi32(red, 16))));
+        }
+    };
+
+    // CColorSpace::NormalizeColor() for a vector of pixels
+    template <typename V>
+    void NormalizeColors(typename V::Int& red, typename V::Int& green, typename V::Int& blue)
+    {
+        const auto limit = V::SetInt(255);
+        const auto redOver = V::Greater(red, limit);
+        const auto greenOver = V::AndNot(redOver, V::Greater(green, limit));
+        const auto blueOver = V::AndNot(V::Or(redOver, greenOver), V::Greater(blue, limit));
+        const auto anyOver = V::Or(redOver, V::Or(greenOver, blueOver));
+
+        // Arrange the channels the way CColorSpace::DistributeFirst() gets them
+        const auto first = V::Select(redOver, red, V::Select(greenOver, green, blue));
+        const auto half = V::Half(V::SubInt(first, limit));
+        const auto second = V::AddInt(V::Select(redOver, green, red), half);
+        const auto third = V::AddInt(V::Select(blueOver, green, blue), half);
+
+        const auto secondOver = V::Greater(second, limit);
+        const auto thirdOver = V::AndNot(secondOver, V::Greater(third, limit));
+        const auto newSecond = V::Select(secondOver, limit,
+            V::Select(thirdOver, V::AddInt(second, V::SubInt(third, limit)), second));
+        const auto newThird = V::Select(thirdOver, limit,
+            V::Select(secondOver, V::AddInt(third, V::SubInt(second, limit)), third));
+
+        // Put them back where they came from
+        red = V::Select(redOver, limit, V::Select(anyOver, newSecond, red));
+        green = V::Select(redOver, newSecond, V::Select(greenOver, limit, V::Select(blueOver, newThird, green)));
+        blue = V::Select(blueOver, limit, V::Select(anyOver, newThird, blue));
+    }
+
+    // Bit mask of the lanes whose value is about to truncate differently
+    // than it might in double precision
+    template <typename V>
+    int NearInteger(const typename V::Float value, const double color)
+    {
+        if (color <= 0) return 0;
+        const auto fraction = V::Sub(value, V::ToFloat(V::Truncate(value)));
+        return V::Outside(fraction, 0.001f, 0.999f) & ((1 << V::Width) - 1);
+    }
+
+    // Shades in single precision with a refined reciprocal square root. The
+    // normal is computed relative to the left edge so the large surface
+    // coefficients do not cancel out in float.
+    template <typename V>
+    void ShadeCushionRowVector(const CushionRow& row, const int left, const int right, COLORREF* out)
+    {
+        const auto nxBase = V::Set(static_cast<float>(row.nxScale * (left + 0.5) + row.nxOffset));
+        const auto nxScale = V::Set(static_cast<float>(row.nxScale));
+        const auto lx = V::Set(static_cast<float>(row.lx));
+        const auto nyTerm = V::Set(static_cast<float>(row.ny * row.ly + row.lz));
+        const auto nyLength = V::Set(static_cast<float>(row.ny * row.ny + 1.0));
+        const auto shading = V::Set(static_cast<float>(row.shading * row.factor));
+        const auto ambient = V::Set(static_cast<float>(row.ambient * row.factor));
+        const auto colR = V::Set(static_cast<float>(row.colR));
+        const auto colG = V::Set(static_cast<float>(row.colG));
+        const auto colB = V::Set(static_cast<float>(row.colB));
+        const auto half = V::Set(0.5f);
+        const auto threeHalves = V::Set(1.5f);
+        const auto one = V::Set(1.0f);
+        const auto zero = V::Set(0.0f);
+        const auto step = V::Set(static_cast<float>(V::Width));
+        const auto limit = V::SetInt(255);
+        auto offset = V::Ramp();
+
+        int ix = left;
+        for (; ix + V::Width <= right; ix += V::Width, offset = V::Add(offset, step))
+        {
+            const auto nx = V::Add(nxBase, V::Mul(nxScale, offset));
+            const auto length = V::Add(V::Mul(nx, nx), nyLength);
+
+            // One Newton-Raphson step: y = y * (1.5 - 0.5 * length * y * y)
+            auto inverse = V::RSqrt(length);
+            inverse = V::Mul(inverse, V::Sub(threeHalves, V::Mul(V::Mul(half, length), V::Mul(inverse, inverse))));
+
+            const auto cosa = V::Min(V::Mul(V::Add(V::Mul(nx, lx), nyTerm), inverse), one);
+            const auto pixel = V::Add(V::Max(V::Mul(shading, cosa), zero), ambient);
+
+            const auto redValue = V::Mul(colR, pixel);
+            const auto greenValue = V::Mul(colG, pixel);
+            const auto blueValue = V::Mul(colB, pixel);
+            auto red = V::Truncate(redValue);
+            auto green = V::Truncate(greenValue);
+            auto blue = V::Truncate(blueValue);
+
+            // NormalizeColor() passes the excess of one channel on to the others,
+            // so a channel truncating differently than the reference would end
+            // up more than one off; those pixels are redone in double precision.
+            // Only the brightest parts of a cushion overflow at all.
+            int redo = 0;
+            if (row.normalize && V::Any(V::Or(V::Greater(red, limit), V::Or(V::Greater(green, limit), V::Greater(blue, limit)))))
+            {
+                NormalizeColors<V>(red, green, blue);
+                redo = NearInteger<V>(redValue, row.colR) |
+                    NearInteger<V>(greenValue, row.colG) |
+                    NearInteger<V>(blueValue, row.colB);
+            }
+
+            V::Store(out + ix, red, green, blue);
+            for (; redo != 0; redo &= redo - 1)
+            {
+                const int i = ix + std::countr_zero(static_cast<unsigned int>(redo));
+                out[i] = MakeCushionColor(row, CushionPixel(row, i));
+            }
+        }
+
+        ShadeCushionRowScalar(row, ix, right, out);
+    }
+#endif
+
+    // Picks the widest kernel the processor supports; a NEON kernel would
+    // slot in here for ARM builds
+    CushionRowKernel SelectCushionRowKernel()
+    {
+#ifdef CUSHION_SIMD
+        if (IsProcessorFeaturePresent(PF_AVX2_INSTRUCTIONS_AVAILABLE)) return ShadeCushionRowVector<Avx2>;
+        if (IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE)) return ShadeCushionRowVector<Sse2>;
+#endif
+        return ShadeCushionRowScalar;
+    }
+
+    const CushionRowKernel ShadeCushionRow = SelectCushionRowKernel();
+
+    // Smaller treemaps are drawn on the calling thread only
+    constexpr int PARALLEL_RENDER_AREA = 512 * 512;
+
+    // Enough jobs per thread that threads finishing early still find work
+    constexpr int JOBS_PER_THREAD = 16;
+
+    // Subtrees below this size are cheaper to lay out right away
+    constexpr int MIN_JOB_AREA = 1024;
+
+    // Leaves are rasterised in batches of at least this many pixels
+    constexpr LONGLONG MIN_BATCH_AREA = 4096;
+
+    // Beyond this many changed subtrees a new layout is cheaper than patching the old one
+    constexpr size_t MAX_DIRTY_REGIONS = 64;
+
+    // Rasters are cached in square tiles of this many pixels
+    constexpr int TILE_SIZE = 256;
+
+    // Memory budget for the tile cache (about four screens at 3840x2160)
+    constexpr size_t TILE_CACHE_BYTES = 128 * 1024 * 1024;
+
+    unsigned int GetRenderThreads(const CRect& rc)
+    {
+        if (rc.Width() * rc.Height() < PARALLEL_RENDER_AREA) return 1;
+        return max(1u, std::thread::hardware_concurrency());
+    }
+
+    VOID CALLBACK RunPoolWork(PTP_CALLBACK_INSTANCE, PVOID context, PTP_WORK)
+    {
+        (*static_cast<std::function<void()>*>(context))();
+    }
+
+    // Calls work(0) ... work(count - 1) on up to the given number of threads
+    // of the system pool. The calling thread takes part as well; if the pool
+    // is not available it simply does all the work on its own.
+    void RunInParallel(const size_t count, const unsigned int threads, const std::function<void(size_t)>& work)
+    {
+        std::atomic<size_t> next = 0;
+        std::function<void()> drain = [&]
+        {
+            for (size_t i = next++; i < count; i = next++)
+            {
+                work(i);
+            }
+        };
+
+        const PTP_WORK pool = threads > 1 && count > 1 ? CreateThreadpoolWork(RunPoolWork, &drain, nullptr) : nullptr;
+        if (pool != nullptr)
+        {
+            const size_t helpers = min(static_cast<size_t>(threads - 1), count - 1);
+            for (size_t i = 0; i < helpers; i++)
+            {
+                SubmitThreadpoolWork(pool);
+            }
+        }
+
+        drain();
+
+        if (pool != nullptr)
+        {
+            WaitForThreadpoolWorkCallbacks(pool, FALSE);
+            CloseThreadpoolWork(pool);
+        }
+    }
+}
+
 /////////////////////////////////////////////////////////////////////////////
 
 double CColorSpace::GetColorBrightness(COLORREF color)
@@ -126,7 +488,8 @@ const CTreemap::Options CTreemap::_defaultOptions = {
     0.91,
     0.13,
     -1.0,
-    -1.0
+    -1.0,
+    16
 };
 
 const CTreemap::Options CTreemap::_defaultOptionsOld = {
@@ -138,7 +501,8 @@ const CTreemap::Options CTreemap::_defaultOptionsOld = {
     0.9,
     0.15,
     -1.0,
-    -1.0
+    -1.0,
+    16
 };
 
 const COLORREF CTreemap::_defaultCushionColors[] = {
@@ -319,17 +683,13 @@ void CTreemap::DrawTreemap(CDC* pdc, CRect rc, Item* root, const Options* option
         // This bitmap will be blitted onto the temporary DC
         CBitmap bmp;
 
-        // That bitmap in turn will be created from this array
-        CColorRefArray bitmap_bits;
-        bitmap_bits.SetSize(rc.Width() * rc.Height());
-
-        // Recursively draw the tree graph
-        double surface[4] = {0, 0, 0, 0};
-        CRect baserc({ 0,0 }, rc.Size());
-        RecurseDrawGraph(bitmap_bits, root, baserc, true, surface, m_options.height, 0);
+        // Only redo the layout if more than the lighting has changed,
+        // and only rasterise the parts which changed since the last time
+        UpdateLayout(root, rc);
+        UpdateRaster();
 
         // Fill the bitmap with the array
-        VERIFY(bmp.CreateBitmap(rc.Width(), rc.Height(), 1, 32, &bitmap_bits[0]));
+        VERIFY(bmp.CreateBitmap(rc.Width(), rc.Height(), 1, 32, m_bits.GetData()));
 
         // Render bitmap to the temporary CDC
         dcTreeView.SelectObject(&bmp);
@@ -359,6 +719,160 @@ void CTreemap::DrawTreemap(CDC* pdc, CRect rc, Item* root, const Options* option
     }
 }
 
+void CTreemap::InvalidateLayout()
+{
+    m_snapshot = {};
+    m_itemsDetached = false;
+    m_layoutValid = false;
+    m_layout.clear();
+    m_layout.shrink_to_fit();
+    m_rasterBatches.clear();
+    m_rasterBatches.shrink_to_fit();
+    m_hitMap.clear();
+    m_hitMap.shrink_to_fit();
+    m_bits.RemoveAll();
+    m_dirtyArea.SetRectEmpty();
+    DropTiles();
+}
+
+void CTreemap::DetachItems()
+{
+    m_itemsDetached = true;
+}
+
+bool CTreemap::UpdateItems(Item* root, const std::vector<Item*>& items)
+{
+    // Tiles of any view may show the old tree
+    DropTiles();
+
+    // Freed items are only compared against below and every node
+    // they occupied is either replaced or the snapshot is dropped
+    m_itemsDetached = false;
+
+    if (!m_layoutValid || root != m_layoutKey.root || items.size() > MAX_DIRTY_REGIONS)
+    {
+        InvalidateLayout();
+        return false;
+    }
+
+    // Looks up the current nodes of a few items
+    const auto findNodes = [this](const std::vector<Item*>& wanted)
+    {
+        std::vector<UINT> nodes(wanted.size(), UINT_MAX);
+        for (size_t i = 0; i < wanted.size(); i++)
+        {
+            const auto found = m_snapshot.nodes.find(wanted[i]);
+            if (found != m_snapshot.nodes.end()) nodes[i] = found->second;
+        }
+        return nodes;
+    };
+
+    // Items which cannot be found, i.e. files and folders which are new or
+    // drawn as one block, are not worth the trouble and neither is the first
+    // item; a new snapshot only copies what is visible
+    const std::vector<UINT> nodes = findNodes(items);
+    if (std::ranges::find(nodes, UINT_MAX) != nodes.end() || std::ranges::find(nodes, 0u) != nodes.end())
+    {
+        InvalidateLayout();
+        return false;
+    }
+
+    // Copy the changed subtrees again. An item below another one of the
+    // list has already been copied along with it.
+    std::vector<Item*> relayout;
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        if (m_snapshot.items[nodes[i]] != items[i]) continue;
+        ReloadNode(nodes[i]);
+        relayout.push_back(items[i]);
+    }
+
+    // Then take over the new sizes of the ancestors, deepest first so that
+    // moving the children of one never invalidates a node still to be done
+    std::vector<std::pair<size_t, UINT>> ancestors;
+    for (const UINT node : nodes)
+    {
+        if (m_snapshot.items[node] == nullptr) continue;
+        std::vector<UINT> chain;
+        for (UINT a = m_snapshot.parents[node]; a != UINT_MAX; a = m_snapshot.parents[a])
+        {
+            chain.push_back(a);
+        }
+        for (size_t i = 0; i < chain.size(); i++)
+        {
+            ancestors.emplace_back(chain.size() - i, chain[i]);
+        }
+    }
+    std::ranges::sort(ancestors, std::greater());
+    const auto [last, end] = std::ranges::unique(ancestors);
+    ancestors.erase(last, end);
+    for (const auto& ancestor : ancestors)
+    {
+        if (!ReloadChildren(ancestor.second))
+        {
+            relayout.push_back(m_snapshot.items[ancestor.second]);
+        }
+    }
+
+    // Start over once the snapshot holds more released nodes than live ones
+    const auto released = std::ranges::count(m_snapshot.items, static_cast<Item*>(nullptr));
+    if (!m_layoutValid || static_cast<size_t>(released) * 2 > m_snapshot.items.size())
+    {
+        InvalidateLayout();
+        return false;
+    }
+
+    // Mark the subtrees to lay out again and the way down to them
+    const std::vector<UINT> relayoutNodes = findNodes(relayout);
+    if (std::ranges::find(relayoutNodes, UINT_MAX) != relayoutNodes.end())
+    {
+        InvalidateLayout();
+        return false;
+    }
+
+    std::vector<bool> changed(m_snapshot.items.size());
+    std::vector<bool> touched(m_snapshot.items.size());
+    for (const UINT node : relayoutNodes)
+    {
+        changed[node] = true;
+        for (UINT n = node; n != UINT_MAX && !touched[n]; n = m_snapshot.parents[n])
+        {
+            touched[n] = true;
+        }
+    }
+
+    const CRect area(0, 0, m_layoutKey.width, m_layoutKey.height);
+    std::vector<DirtyRegion> dirty;
+    const double surface[4] = {0, 0, 0, 0};
+    if (!FindDirtyRegions(dirty, m_rootNode, area, true, surface, m_options.height, touched, changed) ||
+        dirty.size() > MAX_DIRTY_REGIONS)
+    {
+        // The snapshot is up to date, so only the layout has to be redone
+        m_layoutValid = false;
+        return false;
+    }
+
+    // All leaves of a subtree lie within its rectangle
+    std::erase_if(m_layout, [&dirty](const LayoutLeaf& leaf)
+    {
+        return std::ranges::any_of(dirty, [&leaf](const DirtyRegion& region)
+        {
+            return leaf.rc.left >= region.rc.left && leaf.rc.right <= region.rc.right &&
+                leaf.rc.top >= region.rc.top && leaf.rc.bottom <= region.rc.bottom;
+        });
+    });
+
+    for (const auto& region : dirty)
+    {
+        RecurseLayout(m_layout, region.node, region.rc, false, region.surface, region.h);
+        m_dirtyArea.UnionRect(m_dirtyArea, region.rc);
+    }
+
+    m_hitMap.clear();
+    BuildRasterBatches(GetRenderThreads(area));
+    return true;
+}
+
 void CTreemap::DrawTreemapDoubleBuffered(CDC* pdc, const CRect& rc, Item* root, const Options* options)
 {
     if (options != nullptr)
@@ -389,6 +903,31 @@ void CTreemap::DrawTreemapDoubleBuffered(CDC* pdc, const CRect& rc, Item* root,
 CTreemap::Item* CTreemap::FindItemByPoint(Item* item, CPoint point)
 {
     ASSERT(item != NULL);
+
+    // Neither the snapshot nor the tree it was taken from can be trusted
+    if (m_itemsDetached)
+    {
+        return nullptr;
+    }
+
+    if (m_layoutValid && item == m_layoutKey.root)
+    {
+        if (!CRect(0, 0, m_layoutKey.width, m_layoutKey.height).PtInRect(point))
+        {
+            return nullptr;
+        }
+
+        if (m_hitMap.empty())
+        {
+            BuildHitMap();
+        }
+
+        // The leaves tile the whole root rectangle
+        const UINT node = m_hitMap[static_cast<size_t>(point.y) * m_layoutKey.width + point.x];
+        ASSERT(node != UINT_MAX);
+        return m_snapshot.items[node != UINT_MAX ? node : m_rootNode];
+    }
+
     const CRect& rc = item->TmiGetRectangle();
 
     if (!rc.PtInRect(point))
@@ -488,6 +1027,20 @@ CTreemap::Item* CTreemap::FindItemByPoint(Item* item, CPoint point)
     return ret;
 }
 
+bool CTreemap::EnumerateLeaves(const Item* root, const std::function<void(Item*, const CRect&)>& visit) const
+{
+    if (!m_layoutValid || m_itemsDetached || root != m_layoutKey.root)
+    {
+        return false;
+    }
+
+    for (const auto& leaf : m_layout)
+    {
+        visit(m_snapshot.items[leaf.node], leaf.rc);
+    }
+    return true;
+}
+
 void CTreemap::DrawColorPreview(CDC* pdc, const CRect& rc, COLORREF color, const Options* options)
 {
     if (options != nullptr)
@@ -536,55 +1089,739 @@ void CTreemap::DrawColorPreview(CDC* pdc, const CRect& rc, COLORREF color, const
     VERIFY(dcTreeView.DeleteDC());
 }
 
-void CTreemap::RecurseDrawGraph(
-    CColorRefArray& bitmap,
-    Item* item,
+void CTreemap::RecurseLayout(
+    std::vector<LayoutLeaf>& leaves,
+    UINT node,
     const CRect& rc,
     bool asroot,
     const double* psurface,
-    double h,
-    DWORD flags
+    double h
 )
 {
     ASSERT(rc.Width() >= 0);
     ASSERT(rc.Height() >= 0);
 
-    ASSERT(item->TmiGetSize() > 0);
+    ASSERT(m_snapshot.sizes[node] > 0);
+
+    // UpdateItems() only wants to know where the children would go
+    if (m_probe != nullptr)
+    {
+        m_probe->emplace_back(node, rc);
+        return;
+    }
 
-    item->TmiSetRectangle(rc);
+    m_snapshot.items[node]->TmiSetRectangle(rc);
 
     const int gridWidth = m_options.grid ? 1 : 0;
 
     if (rc.Width() <= gridWidth || rc.Height() <= gridWidth)
     {
+        // Nothing is left to draw besides the grid line, but hit testing
+        // still has to find the item there
+        if (rc.Width() > 0 && rc.Height() > 0)
+        {
+            leaves.push_back(LayoutLeaf{ rc, {}, 0, node });
+        }
         return;
     }
 
+    // The children are copied into the snapshot once they are drawn in detail
+    const bool detailed = asroot || rc.Width() * rc.Height() >= m_options.detailArea;
+    if (detailed && !m_snapshotFrozen && !IsExpanded(node))
+    {
+        ExpandNode(node);
+    }
+
+    // Subtrees below the detail threshold are drawn as a single block in the
+    // color of their largest file, so the layout never visits their items.
+    // Their first child is marked like the children that got no room so
+    // that nothing walks into the stale rectangles further down.
+    const bool leaf = IsExpanded(node) && m_snapshot.childCount[node] == 0;
+    const COLORREF dominant = leaf || detailed ? 0 : GetDominantColor(node);
+    if (!leaf && !detailed && dominant != CLR_INVALID)
+    {
+        Item* item = m_snapshot.items[node];
+        if (item->TmiGetChildCount() > 0)
+        {
+            item->TmiGetChild(0)->TmiSetRectangle(CRect(-1, -1, -1, -1));
+        }
+
+        LayoutLeaf& added = leaves.emplace_back(LayoutLeaf{ rc, {}, dominant, node });
+        std::copy_n(psurface, _countof(added.surface), added.surface);
+        AddRidge(rc, added.surface, h);
+        return;
+    }
+
+    // The render threads must not add to the snapshot. Where the subtree
+    // they got has not been expanded far enough, they leave a leaf without
+    // color behind and UpdateLayout() lays out that part afterwards.
+    if (!IsExpanded(node) || dominant == CLR_INVALID)
+    {
+        LayoutLeaf& missed = leaves.emplace_back(LayoutLeaf{ rc, {}, CLR_INVALID, node });
+        std::copy_n(psurface, _countof(missed.surface), missed.surface);
+        return;
+    }
+
+    // During the layout pass of a parallel render, hand off the subtrees
+    // which are small enough to the render threads
+    if (m_jobs != nullptr && !asroot && !leaf &&
+        rc.Width() * rc.Height() >= MIN_JOB_AREA && rc.Width() * rc.Height() <= m_jobArea)
+    {
+        ExpandForArea(node, static_cast<double>(rc.Width()) * rc.Height());
+        LayoutJob& job = m_jobs->emplace_back(LayoutJob{ node, rc, {}, h });
+        std::copy_n(psurface, _countof(job.surface), job.surface);
+        return;
+    }
+
+    // The surface is kept even without cushion shading so that switching
+    // it on only needs another rasterisation
+    double surface[4];
+    std::copy_n(psurface, _countof(surface), surface);
+    if (!asroot)
+    {
+        AddRidge(rc, surface, h);
+    }
+
+    if (leaf)
+    {
+        LayoutLeaf& added = leaves.emplace_back(LayoutLeaf{ rc, {}, m_snapshot.colors[node], node });
+        std::copy_n(surface, _countof(added.surface), added.surface);
+    }
+    else
+    {
+        LayoutChildren(leaves, node, rc, surface, h);
+    }
+}
+
+void CTreemap::UpdateLayout(Item* root, const CRect& rc)
+{
+    const LayoutKey key = { root, rc.Width(), rc.Height(), m_options.style, m_options.grid, m_options.height, m_options.scaleFactor, m_options.detailArea };
+    if (m_layoutValid && key == m_layoutKey)
+    {
+        return;
+    }
+
+    // A snapshot which may hold freed items cannot be laid out again
+    if (m_itemsDetached)
+    {
+        InvalidateLayout();
+    }
+
+    // A zoom only picks another node as long as the snapshot contains it
+    UINT rootNode = 0;
+    if (const auto found = m_snapshot.nodes.find(root); found != m_snapshot.nodes.end())
+    {
+        rootNode = found->second;
+    }
+    else
+    {
+        BuildSnapshot(root);
+    }
+
+    m_layout.clear();
+    m_hitMap.clear();
+    m_rootNode = rootNode;
     double surface[4] = {0, 0, 0, 0};
-    if (IsCushionShading())
+    const CRect baserc({ 0, 0 }, rc.Size());
+    const unsigned int threads = GetRenderThreads(rc);
+    if (threads > 1)
     {
-        for (int i = 0; i < _countof(surface); i++)
+        // The layout pass only descends until subtrees are small enough to
+        // be laid out by the render threads; their rectangles do not overlap
+        std::vector<LayoutJob> jobs;
+        m_jobs = &jobs;
+        m_jobArea = max(MIN_JOB_AREA, baserc.Width() * baserc.Height() / static_cast<int>(threads * JOBS_PER_THREAD));
+        RecurseLayout(m_layout, rootNode, baserc, true, surface, m_options.height);
+        m_jobs = nullptr;
+
+        // Start with the largest subtrees so the small ones fill the gaps at the end
+        std::ranges::sort(jobs, [](const LayoutJob& a, const LayoutJob& b)
+        {
+            return a.rc.Width() * a.rc.Height() > b.rc.Width() * b.rc.Height();
+        });
+        m_snapshotFrozen = true;
+        RunInParallel(jobs.size(), threads, [&](const size_t i)
         {
-            surface[i] = psurface[i];
+            LayoutJob& job = jobs[i];
+            RecurseLayout(job.leaves, job.node, job.rc, false, job.surface, job.h);
+        });
+        m_snapshotFrozen = false;
+
+        // Lay out what the render threads left behind. Every level below the
+        // job has its height scaled once more.
+        const auto isMissed = [](const LayoutLeaf& leaf) { return leaf.color == CLR_INVALID; };
+        for (auto& job : jobs)
+        {
+            std::vector<LayoutLeaf> missed;
+            std::ranges::copy_if(job.leaves, std::back_inserter(missed), isMissed);
+            std::erase_if(job.leaves, isMissed);
+            for (const auto& leaf : missed)
+            {
+                double h = job.h;
+                for (UINT n = leaf.node; n != job.node; n = m_snapshot.parents[n])
+                {
+                    h *= m_options.scaleFactor;
+                }
+                RecurseLayout(job.leaves, leaf.node, leaf.rc, false, leaf.surface, h);
+            }
         }
 
-        if (!asroot)
+        for (const auto& job : jobs)
         {
-            AddRidge(rc, surface, h);
+            m_layout.insert(m_layout.end(), job.leaves.begin(), job.leaves.end());
         }
     }
+    else
+    {
+        RecurseLayout(m_layout, rootNode, baserc, true, surface, m_options.height);
+    }
+
+    BuildRasterBatches(threads);
+    m_layoutKey = key;
+    m_layoutValid = true;
+    m_dirtyArea = baserc;
+}
+
+void CTreemap::BuildSnapshot(Item* root)
+{
+    m_snapshot = {};
+    AddNode(root, UINT_MAX);
+}
 
+UINT CTreemap::AddNode(Item* item, const UINT parent)
+{
+    const auto node = static_cast<UINT>(m_snapshot.items.size());
+    m_snapshot.items.push_back(item);
+    m_snapshot.sizes.push_back(item->TmiGetSize());
+    m_snapshot.parents.push_back(parent);
+    m_snapshot.firstChild.push_back(UINT_MAX);
+    m_snapshot.childCount.push_back(0);
+    m_snapshot.colors.push_back(CLR_INVALID);
+    return node;
+}
+
+void CTreemap::ForgetNode(const UINT node)
+{
+    // A freed item may share its address with one added since, which keeps its entry
+    const auto found = m_snapshot.nodes.find(m_snapshot.items[node]);
+    if (found != m_snapshot.nodes.end() && found->second == node)
+    {
+        m_snapshot.nodes.erase(found);
+    }
+    m_snapshot.items[node] = nullptr;
+}
+
+bool CTreemap::IsExpanded(const UINT node) const
+{
+    return m_snapshot.firstChild[node] != UINT_MAX;
+}
+
+void CTreemap::ExpandNode(const UINT node)
+{
+    ASSERT(!m_snapshotFrozen);
+
+    Item* item = m_snapshot.items[node];
+    m_snapshot.firstChild[node] = static_cast<UINT>(m_snapshot.items.size());
     if (item->TmiIsLeaf())
     {
-        RenderLeaf(bitmap, item, surface);
+        m_snapshot.colors[node] = item->TmiGetGraphColor();
+        return;
     }
-    else
+
+    // Only the folders are looked up, that keeps the map small
+    m_snapshot.colors[node] = 0;
+    m_snapshot.nodes.insert_or_assign(item, node);
+    if (m_snapshot.sizes[node] > 0)
     {
-        ASSERT(item->TmiGetChildCount() > 0);
-        ASSERT(item->TmiGetSize() > 0);
+        // Items without size are never laid out, so their children are left out
+        const int count = item->TmiGetChildCount();
+        m_snapshot.childCount[node] = count;
+        for (int c = 0; c < count; c++)
+        {
+            AddNode(item->TmiGetChild(c), node);
+        }
+    }
+}
+
+void CTreemap::ExpandForArea(const UINT node, const double area)
+{
+    // The children get the share of the area their size stands for. Rounding
+    // makes the rectangles of the layout differ a little, which the margin
+    // makes up for in all but a few cases. The subtrees drawn as one block
+    // only need their color; leaves are expanded anyway as that adds nothing.
+    std::vector<std::pair<UINT, double>> pending{ { node, area } };
+    while (!pending.empty())
+    {
+        const auto [n, a] = pending.back();
+        pending.pop_back();
+
+        if (a * 2 < m_options.detailArea && !m_snapshot.items[n]->TmiIsLeaf())
+        {
+            GetDominantColor(n);
+            continue;
+        }
+
+        if (!IsExpanded(n))
+        {
+            ExpandNode(n);
+        }
+        const UINT first = m_snapshot.firstChild[n];
+        for (UINT c = first; c < first + m_snapshot.childCount[n]; c++)
+        {
+            if (m_snapshot.sizes[c] > 0)
+            {
+                pending.emplace_back(c, a * static_cast<double>(m_snapshot.sizes[c]) / static_cast<double>(m_snapshot.sizes[n]));
+            }
+        }
+    }
+}
+
+void CTreemap::ReloadNode(const UINT node)
+{
+    ReleaseNodes(node);
+    m_snapshot.sizes[node] = m_snapshot.items[node]->TmiGetSize();
+    m_snapshot.firstChild[node] = UINT_MAX;
+    m_snapshot.colors[node] = CLR_INVALID;
+}
+
+void CTreemap::ReleaseNodes(const UINT node)
+{
+    // The items themselves may already be gone, so only the indices are followed
+    std::vector<UINT> pending{ node };
+    while (!pending.empty())
+    {
+        const UINT n = pending.back();
+        pending.pop_back();
+
+        const UINT first = m_snapshot.firstChild[n];
+        for (UINT c = 0; c < m_snapshot.childCount[n]; c++)
+        {
+            ForgetNode(first + c);
+            pending.push_back(first + c);
+        }
+        m_snapshot.childCount[n] = 0;
+    }
+}
+
+bool CTreemap::ReloadChildren(const UINT node)
+{
+    const Item* item = m_snapshot.items[node];
+    m_snapshot.sizes[node] = item->TmiGetSize();
+
+    const UINT first = m_snapshot.firstChild[node];
+    const UINT count = m_snapshot.childCount[node];
+    const UINT newCount = m_snapshot.sizes[node] > 0 ? item->TmiGetChildCount() : 0;
+
+    bool unchanged = newCount == count;
+    for (UINT c = 0; unchanged && c < count; c++)
+    {
+        unchanged = item->TmiGetChild(c) == m_snapshot.items[first + c];
+    }
+    if (unchanged)
+    {
+        for (UINT c = first; c < first + count; c++)
+        {
+            m_snapshot.sizes[c] = m_snapshot.items[c]->TmiGetSize();
+        }
+        return true;
+    }
+
+    // The children have to stay next to each other, so they move to the end;
+    // the ones which are still there take their subtrees along
+    std::unordered_map<const Item*, UINT> previous;
+    for (UINT c = first; c < first + count; c++)
+    {
+        previous.emplace(m_snapshot.items[c], c);
+    }
+
+    // New children are expanded once they are laid out
+    const UINT newFirst = static_cast<UINT>(m_snapshot.items.size());
+    for (UINT c = 0; c < newCount; c++)
+    {
+        const UINT moved = AddNode(item->TmiGetChild(c), node);
+        const auto old = previous.find(m_snapshot.items[moved]);
+        if (old == previous.end())
+        {
+            continue;
+        }
+
+        const UINT n = old->second;
+        previous.erase(old);
+        if (const auto found = m_snapshot.nodes.find(m_snapshot.items[moved]); found != m_snapshot.nodes.end())
+        {
+            found->second = moved;
+        }
+        m_snapshot.firstChild[moved] = m_snapshot.firstChild[n];
+        m_snapshot.childCount[moved] = m_snapshot.childCount[n];
+        m_snapshot.colors[moved] = m_snapshot.colors[n];
+        for (UINT g = 0; g < m_snapshot.childCount[n]; g++)
+        {
+            m_snapshot.parents[m_snapshot.firstChild[n] + g] = moved;
+        }
+        m_snapshot.items[n] = nullptr;
+        m_snapshot.childCount[n] = 0;
+
+        // Leaves of the current layout may still refer to the old node
+        if (n == m_rootNode)
+        {
+            m_layoutValid = false;
+        }
+    }
+
+    for (const auto& [gone, n] : previous)
+    {
+        ReleaseNodes(n);
+        ForgetNode(n);
+    }
+    m_snapshot.firstChild[node] = newFirst;
+    m_snapshot.childCount[node] = newCount;
+    return false;
+}
+
+bool CTreemap::FindDirtyRegions(
+    std::vector<DirtyRegion>& dirty,
+    const UINT node,
+    const CRect& rc,
+    const bool asroot,
+    const double* psurface,
+    const double h,
+    const std::vector<bool>& touched,
+    const std::vector<bool>& changed
+)
+{
+    m_snapshot.items[node]->TmiSetRectangle(rc);
+
+    const auto addRegion = [&]
+    {
+        if (asroot) return false;
+        DirtyRegion& region = dirty.emplace_back(DirtyRegion{ node, rc, {}, h });
+        std::copy_n(psurface, _countof(region.surface), region.surface);
+        return true;
+    };
+
+    // Subtrees which changed themselves or are drawn without their children
+    // are laid out again as a whole
+    const int gridWidth = m_options.grid ? 1 : 0;
+    if (changed[node] || m_snapshot.childCount[node] == 0 ||
+        rc.Width() <= gridWidth || rc.Height() <= gridWidth ||
+        !asroot && rc.Width() * rc.Height() < m_options.detailArea)
+    {
+        return addRegion();
+    }
+
+    double surface[4];
+    std::copy_n(psurface, _countof(surface), surface);
+    if (!asroot)
+    {
+        AddRidge(rc, surface, h);
+    }
+
+    // Lay out the children without descending. The rectangles of the changed
+    // ones cannot be compared since the scan has reset them, but if all other
+    // children keep theirs, a single changed one is left with its old place.
+    std::vector<std::pair<UINT, CRect>> probe;
+    std::vector<LayoutLeaf> unused;
+    m_probe = &probe;
+    LayoutChildren(unused, node, rc, surface, h);
+    m_probe = nullptr;
+
+    int moved = 0;
+    for (const auto& [child, rcChild] : probe)
+    {
+        if (touched[child]) moved++;
+        else if (m_snapshot.items[child]->TmiGetRectangle() != rcChild) return addRegion();
+    }
+    if (moved > 1)
+    {
+        return addRegion();
+    }
+
+    for (const auto& [child, rcChild] : probe)
+    {
+        if (touched[child])
+        {
+            FindDirtyRegions(dirty, child, rcChild, false, surface, h * m_options.scaleFactor, touched, changed);
+        }
+        else
+        {
+            m_snapshot.items[child]->TmiSetRectangle(rcChild);
+        }
+    }
+    return true;
+}
+
+COLORREF CTreemap::GetDominantColor(UINT node)
+{
+    // Children come sorted by size, so the largest file is down the first ones
+    while (IsExpanded(node) && m_snapshot.childCount[node] > 0)
+    {
+        node = m_snapshot.firstChild[node];
+    }
+
+    // Below the snapshot the way down is followed in the tree itself and
+    // only its end is kept. The render threads cannot look it up there.
+    if (m_snapshot.colors[node] == CLR_INVALID && !m_snapshotFrozen)
+    {
+        const Item* item = m_snapshot.items[node];
+        while (!item->TmiIsLeaf() && item->TmiGetChildCount() > 0)
+        {
+            item = item->TmiGetChild(0);
+        }
+        m_snapshot.colors[node] = item->TmiIsLeaf() ? item->TmiGetGraphColor() : 0;
+    }
+    return m_snapshot.colors[node];
+}
+
+void CTreemap::BuildHitMap()
+{
+    const LONG width = m_layoutKey.width;
+    m_hitMap.assign(static_cast<size_t>(width) * m_layoutKey.height, UINT_MAX);
+    for (const auto& leaf : m_layout)
+    {
+        for (int y = leaf.rc.top; y < leaf.rc.bottom; y++)
+        {
+            std::fill_n(&m_hitMap[static_cast<size_t>(y) * width + leaf.rc.left], leaf.rc.Width(), leaf.node);
+        }
+    }
+}
+
+void CTreemap::BuildRasterBatches(const unsigned int threads)
+{
+    m_rasterBatches.clear();
+
+    LONGLONG total = 0;
+    for (const auto& leaf : m_layout)
+    {
+        total += static_cast<LONGLONG>(leaf.rc.Width()) * leaf.rc.Height();
+    }
+    const LONGLONG batchArea = max(MIN_BATCH_AREA, total / (threads * JOBS_PER_THREAD));
+
+    size_t first = 0;
+    LONGLONG area = 0;
+    for (size_t i = 0; i < m_layout.size(); i++)
+    {
+        const CRect& rc = m_layout[i].rc;
+        const LONGLONG leafArea = static_cast<LONGLONG>(rc.Width()) * rc.Height();
+        if (leafArea > batchArea)
+        {
+            // Large leaves are split into bands of rows
+            if (first < i) m_rasterBatches.push_back({ first, i, INT_MIN, INT_MAX });
+            const int rows = static_cast<int>(max(1LL, batchArea / rc.Width()));
+            for (int top = rc.top; top < rc.bottom; top += rows)
+            {
+                m_rasterBatches.push_back({ i, i + 1, top, top + rows });
+            }
+            first = i + 1;
+            area = 0;
+            continue;
+        }
+
+        area += leafArea;
+        if (area >= batchArea)
+        {
+            m_rasterBatches.push_back({ first, i + 1, INT_MIN, INT_MAX });
+            first = i + 1;
+            area = 0;
+        }
+    }
+    if (first < m_layout.size()) m_rasterBatches.push_back({ first, m_layout.size(), INT_MIN, INT_MAX });
+}
+
+void CTreemap::RasterizeLayout(CColorRefArray& bitmap)
+{
+    // The leaves do not overlap, so the batches never share pixels
+    RunInParallel(m_rasterBatches.size(), GetRenderThreads(m_renderArea), [&](const size_t i)
+    {
+        const RasterBatch& batch = m_rasterBatches[i];
+        for (size_t leaf = batch.first; leaf < batch.last; leaf++)
+        {
+            RenderLeaf(bitmap, m_layout[leaf], CRect(INT_MIN, batch.top, INT_MAX, batch.bottom));
+        }
+    });
+}
+
+void CTreemap::UpdateRaster()
+{
+    const CRect area(0, 0, m_layoutKey.width, m_layoutKey.height);
+    if (m_bits.GetSize() != area.Width() * area.Height() || m_bitsOptions != m_options)
+    {
+        m_dirtyArea = area;
+    }
+
+    if (m_dirtyArea == area)
+    {
+        m_bits.RemoveAll();
+        m_bits.SetSize(area.Width() * area.Height());
+
+        // Tiles of a view which was shown before are only copied back
+        const std::vector<CRect> missing = LoadTiles(m_bits);
+        if (missing.size() == GetTiles().size())
+        {
+            RasterizeLayout(m_bits);
+        }
+        else
+        {
+            RasterizeTiles(m_bits, missing);
+        }
+        StoreTiles(m_bits, missing);
+    }
+    else if (!m_dirtyArea.IsRectEmpty())
+    {
+        // Pixels covered by no leaf belong to the grid and stay black
+        for (int y = m_dirtyArea.top; y < m_dirtyArea.bottom; y++)
+        {
+            std::fill_n(&m_bits[y * area.Width() + m_dirtyArea.left], m_dirtyArea.Width(), COLORREF{ 0 });
+        }
 
-        DrawChildren(bitmap, item, surface, h, flags);
+        // Leaves reaching into the area are drawn again where they overlap it
+        std::vector<size_t> leaves;
+        for (size_t i = 0; i < m_layout.size(); i++)
+        {
+            if (CRect test; test.IntersectRect(m_layout[i].rc, m_dirtyArea)) leaves.push_back(i);
+        }
+        RunInParallel(leaves.size(), GetRenderThreads(m_dirtyArea), [&](const size_t i)
+        {
+            RenderLeaf(m_bits, m_layout[leaves[i]], m_dirtyArea);
+        });
+
+        // The cache was emptied when the tree changed
+        StoreTiles(m_bits, GetTiles());
+    }
+
+    m_bitsOptions = m_options;
+    m_dirtyArea.SetRectEmpty();
+}
+
+size_t CTreemap::TileKeyHash::operator()(const TileKey& key) const
+{
+    const Options& o = key.options;
+    size_t hash = std::hash<const Item*>()(key.root);
+    for (const size_t value : {
+        static_cast<size_t>(key.width), static_cast<size_t>(key.height),
+        static_cast<size_t>(key.column), static_cast<size_t>(key.row),
+        static_cast<size_t>(o.style), static_cast<size_t>(o.grid), static_cast<size_t>(o.gridColor),
+        std::hash<double>()(o.brightness), std::hash<double>()(o.height), std::hash<double>()(o.scaleFactor),
+        std::hash<double>()(o.ambientLight), std::hash<double>()(o.lightSourceX), std::hash<double>()(o.lightSourceY),
+        static_cast<size_t>(o.detailArea) })
+    {
+        hash ^= value + 0x9e3779b9 + (hash << 6) + (hash >> 2);
     }
+    return hash;
+}
+
+std::vector<CRect> CTreemap::GetTiles() const
+{
+    std::vector<CRect> tiles;
+    for (int top = 0; top < m_layoutKey.height; top += TILE_SIZE)
+    {
+        for (int left = 0; left < m_layoutKey.width; left += TILE_SIZE)
+        {
+            tiles.emplace_back(left, top, min(left + TILE_SIZE, m_layoutKey.width), min(top + TILE_SIZE, m_layoutKey.height));
+        }
+    }
+    return tiles;
+}
+
+CTreemap::TileKey CTreemap::GetTileKey(const CRect& tile) const
+{
+    return { m_layoutKey.root, m_layoutKey.width, m_layoutKey.height, m_options, tile.left / TILE_SIZE, tile.top / TILE_SIZE };
+}
+
+std::vector<CRect> CTreemap::LoadTiles(CColorRefArray& bitmap)
+{
+    std::vector<CRect> missing;
+    for (const auto& tile : GetTiles())
+    {
+        const auto it = m_tileIndex.find(GetTileKey(tile));
+        if (it == m_tileIndex.end())
+        {
+            missing.push_back(tile);
+            continue;
+        }
+
+        m_tiles.splice(m_tiles.begin(), m_tiles, it->second);
+        const COLORREF* src = it->second->bits.data();
+        for (int y = tile.top; y < tile.bottom; y++, src += tile.Width())
+        {
+            std::copy_n(src, tile.Width(), &bitmap[y * m_layoutKey.width + tile.left]);
+        }
+    }
+    return missing;
+}
+
+void CTreemap::StoreTiles(const CColorRefArray& bitmap, const std::vector<CRect>& tiles)
+{
+    for (const auto& tile : tiles)
+    {
+        const TileKey key = GetTileKey(tile);
+        if (const auto it = m_tileIndex.find(key); it != m_tileIndex.end())
+        {
+            m_tileBytes -= it->second->bits.size() * sizeof(COLORREF);
+            m_tiles.erase(it->second);
+            m_tileIndex.erase(it);
+        }
+
+        RasterTile& cached = m_tiles.emplace_front(RasterTile{ key, {} });
+        cached.bits.reserve(static_cast<size_t>(tile.Width()) * tile.Height());
+        for (int y = tile.top; y < tile.bottom; y++)
+        {
+            const COLORREF* row = &bitmap.GetData()[y * m_layoutKey.width + tile.left];
+            cached.bits.insert(cached.bits.end(), row, row + tile.Width());
+        }
+        m_tileIndex.emplace(key, m_tiles.begin());
+        m_tileBytes += cached.bits.size() * sizeof(COLORREF);
+    }
+
+    while (m_tileBytes > TILE_CACHE_BYTES)
+    {
+        const RasterTile& oldest = m_tiles.back();
+        m_tileBytes -= oldest.bits.size() * sizeof(COLORREF);
+        m_tileIndex.erase(oldest.key);
+        m_tiles.pop_back();
+    }
+}
+
+void CTreemap::RasterizeTiles(CColorRefArray& bitmap, const std::vector<CRect>& tiles)
+{
+    // Sort the leaves into the tiles they overlap, so that every
+    // tile only renders its own part of them
+    const int columns = (m_layoutKey.width + TILE_SIZE - 1) / TILE_SIZE;
+    const int rows = (m_layoutKey.height + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector<int> slots(static_cast<size_t>(columns) * rows, -1);
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        slots[tiles[i].top / TILE_SIZE * columns + tiles[i].left / TILE_SIZE] = static_cast<int>(i);
+    }
+
+    std::vector<std::vector<size_t>> leaves(tiles.size());
+    for (size_t i = 0; i < m_layout.size(); i++)
+    {
+        const CRect& rc = m_layout[i].rc;
+        if (rc.Width() <= 0 || rc.Height() <= 0) continue;
+
+        for (int row = rc.top / TILE_SIZE; row <= (rc.bottom - 1) / TILE_SIZE; row++)
+        {
+            for (int column = rc.left / TILE_SIZE; column <= (rc.right - 1) / TILE_SIZE; column++)
+            {
+                if (const int slot = slots[row * columns + column]; slot >= 0) leaves[slot].push_back(i);
+            }
+        }
+    }
+
+    RunInParallel(tiles.size(), GetRenderThreads(m_renderArea), [&](const size_t t)
+    {
+        for (const size_t leaf : leaves[t])
+        {
+            RenderLeaf(bitmap, m_layout[leaf], tiles[t]);
+        }
+    });
+}
+
+void CTreemap::DropTiles()
+{
+    m_tiles.clear();
+    m_tileIndex.clear();
+    m_tileBytes = 0;
 }
 
 // My first approach was to make this member pure virtual and have three
@@ -592,25 +1829,25 @@ void CTreemap::RecurseDrawGraph(
 // simply have a member variable of type CTreemap but have to deal with
 // pointers, factory methods and explicit destruction. It's not worth.
 
-void CTreemap::DrawChildren(
-    CColorRefArray& bitmap,
-    Item* parent,
+void CTreemap::LayoutChildren(
+    std::vector<LayoutLeaf>& leaves,
+    UINT parent,
+    const CRect& rc,
     const double* surface,
-    double h,
-    DWORD flags
+    double h
 )
 {
     switch (m_options.style)
     {
     case KDirStatStyle:
         {
-            KDirStat_DrawChildren(bitmap, parent, surface, h, flags);
+            KDirStat_LayoutChildren(leaves, parent, rc, surface, h);
         }
         break;
 
     case SequoiaViewStyle:
         {
-            SequoiaView_DrawChildren(bitmap, parent, surface, h, flags);
+            SequoiaView_LayoutChildren(leaves, parent, rc, surface, h);
         }
         break;
     }
@@ -619,19 +1856,19 @@ void CTreemap::DrawChildren(
 // I learned this squarification style from the KDirStat executable.
 // It's the most complex one here but also the clearest, imho.
 //
-void CTreemap::KDirStat_DrawChildren(CColorRefArray& bitmap, Item* parent, const double* surface, double h, DWORD /*flags*/)
+void CTreemap::KDirStat_LayoutChildren(std::vector<LayoutLeaf>& leaves, UINT parent, const CRect& rc, const double* surface, double h)
 {
-    ASSERT(parent->TmiGetChildCount() > 0);
+    ASSERT(m_snapshot.childCount[parent] > 0);
 
-    const CRect& rc = parent->TmiGetRectangle();
+    const UINT first = m_snapshot.firstChild[parent];
 
     CArray<double, double> rows;     // Our rectangle is divided into rows, each of which gets this height (fraction of total height).
     CArray<int, int> childrenPerRow; // childrenPerRow[i] = # of children in rows[i]
 
     CArray<double, double> childWidth; // Widths of the children (fraction of row width).
-    childWidth.SetSize(parent->TmiGetChildCount());
+    childWidth.SetSize(m_snapshot.childCount[parent]);
 
-    const bool horizontalRows = KDirStat_ArrangeChildren(parent, childWidth, rows, childrenPerRow);
+    const bool horizontalRows = KDirStat_ArrangeChildren(parent, rc, childWidth, rows, childrenPerRow);
 
     const int width  = horizontalRows ? rc.Width() : rc.Height();
     const int height = horizontalRows ? rc.Height() : rc.Width();
@@ -651,7 +1888,6 @@ void CTreemap::KDirStat_DrawChildren(CColorRefArray& bitmap, Item* parent, const
         double left = horizontalRows ? rc.left : rc.top;
         for (int i = 0; i < childrenPerRow[row]; i++, c++)
         {
-            Item* child = parent->TmiGetChild(c);
             ASSERT(childWidth[c] >= 0);
             const double fRight = left + childWidth[c] * width;
             int right           = static_cast<int>(fRight);
@@ -683,12 +1919,12 @@ void CTreemap::KDirStat_DrawChildren(CColorRefArray& bitmap, Item* parent, const
             if(rcChild.Width() > 0 && rcChild.Height() > 0)
             {
                 CRect test;
-                test.IntersectRect(parent->TmiGetRectangle(), rcChild);
+                test.IntersectRect(rc, rcChild);
                 ASSERT(test == rcChild);
             }
 #endif
 
-            RecurseDrawGraph(bitmap, child, rcChild, false, surface, h * m_options.scaleFactor, 0);
+            RecurseLayout(leaves, first + c, rcChild, false, surface, h * m_options.scaleFactor);
 
             if (lastChild)
             {
@@ -696,7 +1932,7 @@ void CTreemap::KDirStat_DrawChildren(CColorRefArray& bitmap, Item* parent, const
 
                 if (i < childrenPerRow[row])
                 {
-                    parent->TmiGetChild(c)->TmiSetRectangle(CRect(-1, -1, -1, -1));
+                    m_snapshot.items[first + c]->TmiSetRectangle(CRect(-1, -1, -1, -1));
                 }
 
                 c += childrenPerRow[row] - i;
@@ -714,27 +1950,27 @@ void CTreemap::KDirStat_DrawChildren(CColorRefArray& bitmap, Item* parent, const
 // return: whether the rows are horizontal.
 //
 bool CTreemap::KDirStat_ArrangeChildren(
-    Item* parent,
+    UINT parent,
+    const CRect& parentRect,
     CArray<double, double>& childWidth,
     CArray<double, double>& rows,
     CArray<int, int>& childrenPerRow
 )
 {
-    ASSERT(!parent->TmiIsLeaf());
-    ASSERT(parent->TmiGetChildCount() > 0);
+    const int childCount = static_cast<int>(m_snapshot.childCount[parent]);
+    ASSERT(childCount > 0);
 
-    if (parent->TmiGetSize() == 0)
+    if (m_snapshot.sizes[parent] == 0)
     {
         rows.Add(1.0);
-        childrenPerRow.Add(parent->TmiGetChildCount());
-        for (int i = 0; i < parent->TmiGetChildCount(); i++)
+        childrenPerRow.Add(childCount);
+        for (int i = 0; i < childCount; i++)
         {
-            childWidth[i] = 1.0 / parent->TmiGetChildCount();
+            childWidth[i] = 1.0 / childCount;
         }
         return true;
     }
 
-    auto const& parentRect = parent->TmiGetRectangle();
     const bool horizontalRows = parentRect.Width() >= parentRect.Height();
 
 
@@ -755,7 +1991,7 @@ bool CTreemap::KDirStat_ArrangeChildren(
     }
 
     int nextChild = 0;
-    while (nextChild < parent->TmiGetChildCount())
+    while (nextChild < childCount)
     {
         int childrenUsed;
         rows.Add(KDirStat_CalculateNextRow(parent, nextChild, width, childrenUsed, childWidth));
@@ -766,23 +2002,26 @@ bool CTreemap::KDirStat_ArrangeChildren(
     return horizontalRows;
 }
 
-double CTreemap::KDirStat_CalculateNextRow(Item* parent, const int nextChild, double width, int& childrenUsed, CArray<double, double>& childWidth)
+double CTreemap::KDirStat_CalculateNextRow(UINT parent, const int nextChild, double width, int& childrenUsed, CArray<double, double>& childWidth)
 {
     int i                                  = 0;
     static constexpr double _minProportion = 0.4;
     ASSERT(_minProportion < 1.);
 
-    ASSERT(nextChild < parent->TmiGetChildCount());
+    const int childCount = static_cast<int>(m_snapshot.childCount[parent]);
+    const ULONGLONG* childSizes = &m_snapshot.sizes[m_snapshot.firstChild[parent]];
+
+    ASSERT(nextChild < childCount);
     ASSERT(width >= 1.0);
 
-    const double mySize = static_cast<double>(parent->TmiGetSize());
+    const double mySize = static_cast<double>(m_snapshot.sizes[parent]);
     ASSERT(mySize > 0);
     ULONGLONG sizeUsed = 0;
     double rowHeight   = 0;
 
-    for (i = nextChild; i < parent->TmiGetChildCount(); i++)
+    for (i = nextChild; i < childCount; i++)
     {
-        const ULONGLONG childSize = parent->TmiGetChild(i)->TmiGetSize();
+        const ULONGLONG childSize = childSizes[i];
         if (childSize == 0)
         {
             ASSERT(i > nextChild); // first child has size > 0
@@ -820,7 +2059,7 @@ double CTreemap::KDirStat_CalculateNextRow(Item* parent, const int nextChild, do
     // and rowHeight is the height of the row.
 
     // We add the rest of the children, if their size is 0.
-    while (i < parent->TmiGetChildCount() && parent->TmiGetChild(i)->TmiGetSize() == 0)
+    while (i < childCount && childSizes[i] == 0)
     {
         i++;
     }
@@ -832,7 +2071,7 @@ double CTreemap::KDirStat_CalculateNextRow(Item* parent, const int nextChild, do
     {
         // Rectangle(1.0 * 1.0) = mySize
         const double rowSize   = mySize * rowHeight;
-        const double childSize = static_cast<double>(parent->TmiGetChild(nextChild + i)->TmiGetSize());
+        const double childSize = static_cast<double>(childSizes[nextChild + i]);
         const double cw        = childSize / rowSize;
         ASSERT(cw >= 0);
         childWidth[nextChild + i] = cw;
@@ -843,26 +2082,30 @@ double CTreemap::KDirStat_CalculateNextRow(Item* parent, const int nextChild, do
 
 // The classical squarification method.
 //
-void CTreemap::SequoiaView_DrawChildren(CColorRefArray& bitmap, Item* parent, const double* surface, double h, DWORD /*flags*/)
+void CTreemap::SequoiaView_LayoutChildren(std::vector<LayoutLeaf>& leaves, UINT parent, const CRect& parentRect, const double* surface, double h)
 {
+    const UINT first = m_snapshot.firstChild[parent];
+    const int childCount = static_cast<int>(m_snapshot.childCount[parent]);
+    const ULONGLONG* childSizes = &m_snapshot.sizes[first];
+
     // Rest rectangle to fill
-    CRect remaining(parent->TmiGetRectangle());
+    CRect remaining(parentRect);
 
     ASSERT(remaining.Width() > 0);
     ASSERT(remaining.Height() > 0);
 
     // Size of rest rectangle
-    ULONGLONG remainingSize = parent->TmiGetSize();
+    ULONGLONG remainingSize = m_snapshot.sizes[parent];
     ASSERT(remainingSize > 0);
 
     // Scale factor
-    const double sizePerSquarePixel = static_cast<double>(parent->TmiGetSize()) / remaining.Width() / remaining.Height();
+    const double sizePerSquarePixel = static_cast<double>(m_snapshot.sizes[parent]) / remaining.Width() / remaining.Height();
 
     // First child for next row
     int head = 0;
 
     // At least one child left
-    while (head < parent->TmiGetChildCount())
+    while (head < childCount)
     {
         ASSERT(remaining.Width() > 0);
         ASSERT(remaining.Height() > 0);
@@ -885,23 +2128,23 @@ void CTreemap::SequoiaView_DrawChildren(CColorRefArray& bitmap, Item* parent, co
         double worst = DBL_MAX;
 
         // Maximum size of children in row
-        const ULONGLONG rmax = parent->TmiGetChild(rowBegin)->TmiGetSize();
+        const ULONGLONG rmax = childSizes[rowBegin];
 
         // Sum of sizes of children in row
         ULONGLONG sum = 0;
 
         // This condition will hold at least once.
-        while (rowEnd < parent->TmiGetChildCount())
+        while (rowEnd < childCount)
         {
             // We check a virtual row made up of child(rowBegin)...child(rowEnd) here.
 
             // Minimum size of child in virtual row
-            const ULONGLONG rmin = parent->TmiGetChild(rowEnd)->TmiGetSize();
+            const ULONGLONG rmin = childSizes[rowEnd];
 
             // If sizes of the rest of the children is zero, we add all of them
             if (rmin == 0)
             {
-                rowEnd = parent->TmiGetChildCount();
+                rowEnd = childCount;
                 break;
             }
 
@@ -967,11 +2210,11 @@ void CTreemap::SequoiaView_DrawChildren(CColorRefArray& bitmap, Item* parent, co
         for (int i = rowBegin; i < rowEnd; i++)
         {
             const int begin       = static_cast<int>(fBegin);
-            const double fraction = static_cast<double>(parent->TmiGetChild(i)->TmiGetSize()) / sum;
+            const double fraction = static_cast<double>(childSizes[i]) / sum;
             const double fEnd     = fBegin + fraction * height;
             int end               = static_cast<int>(fEnd);
 
-            const bool lastChild = i == rowEnd - 1 || parent->TmiGetChild(i + 1)->TmiGetSize() == 0;
+            const bool lastChild = i == rowEnd - 1 || childSizes[i + 1] == 0;
 
             if (lastChild)
             {
@@ -998,7 +2241,7 @@ void CTreemap::SequoiaView_DrawChildren(CColorRefArray& bitmap, Item* parent, co
             ASSERT(rc.top >= remaining.top);
             ASSERT(rc.bottom <= remaining.bottom);
 
-            RecurseDrawGraph(bitmap, parent->TmiGetChild(i), rc, false, surface, h * m_options.scaleFactor, 0);
+            RecurseLayout(leaves, first + i, rc, false, surface, h * m_options.scaleFactor);
 
             if (lastChild)
                 break;
@@ -1027,9 +2270,9 @@ void CTreemap::SequoiaView_DrawChildren(CColorRefArray& bitmap, Item* parent, co
 
         if (remaining.Width() <= 0 || remaining.Height() <= 0)
         {
-            if (head < parent->TmiGetChildCount())
+            if (head < childCount)
             {
-                parent->TmiGetChild(head)->TmiSetRectangle(CRect(-1, -1, -1, -1));
+                m_snapshot.items[first + head]->TmiSetRectangle(CRect(-1, -1, -1, -1));
             }
 
             break;
@@ -1046,21 +2289,26 @@ bool CTreemap::IsCushionShading() const
     && m_options.scaleFactor > 0.0;
 }
 
-void CTreemap::RenderLeaf(CColorRefArray& bitmap, Item* item, const double* surface)
+void CTreemap::RenderLeaf(CColorRefArray& bitmap, const LayoutLeaf& leaf, const CRect& clip)
 {
-    CRect rc = item->TmiGetRectangle();
+    CRect rc = leaf.rc;
 
     if (m_options.grid)
     {
         rc.top++;
         rc.left++;
-        if (rc.Width() <= 0 || rc.Height() <= 0)
-        {
-            return;
-        }
     }
 
-    RenderRectangle(bitmap, rc, surface, item->TmiGetGraphColor());
+    rc.left   = max(rc.left, clip.left);
+    rc.top    = max(rc.top, clip.top);
+    rc.right  = min(rc.right, clip.right);
+    rc.bottom = min(rc.bottom, clip.bottom);
+    if (rc.Width() <= 0 || rc.Height() <= 0)
+    {
+        return;
+    }
+
+    RenderRectangle(bitmap, rc, leaf.surface, leaf.color);
 }
 
 void CTreemap::RenderRectangle(CColorRefArray& bitmap, const CRect& rc, const double* surface, DWORD color)
@@ -1127,51 +2375,28 @@ void CTreemap::DrawCushion(CColorRefArray& bitmap, const CRect& rc, const double
     // Derived parameters
     const double Is = 1 - Ia; // shading
 
-    const double colR = RGB_GET_RVALUE(col);
-    const double colG = RGB_GET_GVALUE(col);
-    const double colB = RGB_GET_BVALUE(col);
-
+    CushionRow row;
+    row.nxScale  = -2 * surface[0];
+    row.nxOffset = -surface[2];
+    row.lx       = m_Lx;
+    row.ly       = m_Ly;
+    row.lz       = m_Lz;
+    row.ambient  = Ia;
+    row.shading  = Is;
+    row.factor   = brightness / PALETTE_BRIGHTNESS;
+    row.colR     = RGB_GET_RVALUE(col);
+    row.colG     = RGB_GET_GVALUE(col);
+    row.colB     = RGB_GET_BVALUE(col);
+
+    // The brightest possible pixel is 1.0 before applying the brightness
+    row.normalize = max(row.colR, max(row.colG, row.colB)) * row.factor >= 255.0;
+
+    COLORREF* bits = bitmap.GetData();
     for (int iy = rc.top; iy < rc.bottom; iy++)
-        for (int ix = rc.left; ix < rc.right; ix++)
-        {
-            const double nx = -(2 * surface[0] * (ix + 0.5) + surface[2]);
-            const double ny = -(2 * surface[1] * (iy + 0.5) + surface[3]);
-            double cosa     = (nx * m_Lx + ny * m_Ly + m_Lz) / sqrt(nx * nx + ny * ny + 1.0);
-            if (cosa > 1.0)
-            {
-                cosa = 1.0;
-            }
-
-            double pixel = Is * cosa;
-            if (pixel < 0)
-            {
-                pixel = 0;
-            }
-
-            pixel += Ia;
-            ASSERT(pixel <= 1.0);
-
-            // Now, pixel is the brightness of the pixel, 0...1.0.
-
-            // Apply contrast.
-            // Not implemented.
-            // Costs performance and nearly the same effect can be
-            // made width the m_options->ambientLight parameter.
-            // pixel = pow(pixel, m_options->contrast);
-
-            // Apply "brightness"
-            pixel *= brightness / PALETTE_BRIGHTNESS;
-
-            // Make color value
-            int red   = static_cast<int>(colR * pixel);
-            int green = static_cast<int>(colG * pixel);
-            int blue  = static_cast<int>(colB * pixel);
-
-            CColorSpace::NormalizeColor(red, green, blue);
-
-            // ... and set!
-            bitmap[ix + iy * m_renderArea.Width()] = BGR(blue, green, red);
-        }
+    {
+        row.ny = -(2 * surface[1] * (iy + 0.5) + surface[3]);
+        ShadeCushionRow(row, rc.left, rc.right, bits + iy * m_renderArea.Width());
+    }
 }
 
 void CTreemap::AddRidge(const CRect& rc, double* surface, double h)
@@ -21,6 +21,11 @@
 
 #pragma once
 
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
 //
 // CColorSpace. Helper class for manipulating colors. Static members only.
 //
@@ -107,6 +112,9 @@ public:
         double ambientLight; // 0..1.0   (default = 0.15)    Factor "Ia"
         double lightSourceX; // -4.0..+4.0 (default = -1.0), negative = left
         double lightSourceY; // -4.0..+4.0 (default = -1.0), negative = top
+        int detailArea;      // 0..oo (default = 16)  Subtrees of fewer pixels are drawn as one block
+
+        bool operator==(const Options&) const = default;
 
         int GetBrightnessPercent()
         {
@@ -214,41 +222,242 @@ public:
     // Same as above but double buffered
     void DrawTreemapDoubleBuffered(CDC* pdc, const CRect& rc, Item* root, const Options* options = nullptr);
 
+    // Forget the current layout and the copy of the tree it was made from;
+    // must be called whenever the tree has changed. Changes of the options
+    // or of the root item are detected by DrawTreemap() itself.
+    void InvalidateLayout();
+
+    // Takes over changes of the tree below the given items (refreshed items
+    // or parents of deleted ones) into the current layout of root. The next
+    // DrawTreemap() then only lays out and rasterises the subtrees whose
+    // rectangles changed. Returns false if the layout was invalidated instead.
+    bool UpdateItems(Item* root, const std::vector<Item*>& items);
+
+    // Must be called before items of the tree are freed while the layout is
+    // kept for UpdateItems(). Until then or InvalidateLayout() the snapshot
+    // may hold freed items, so nothing is looked up or laid out from it.
+    void DetachItems();
+
     // In the resulting treemap, find the item below a given coordinate.
-    // Return value can be NULL, iff point is outside root rect.
+    // Return value can be NULL, iff point is outside root rect. For the
+    // root of the current layout this is a lookup in the hit map.
     Item* FindItemByPoint(Item* root, CPoint point);
 
+    // Calls visit() with every item the current layout of root has drawn a
+    // rectangle for, i.e. the leaves and the subtrees drawn as one block.
+    // Returns false if there is no layout for root.
+    bool EnumerateLeaves(const Item* root, const std::function<void(Item*, const CRect&)>& visit) const;
+
     // Draws a sample rectangle in the given style (for color legend)
     void DrawColorPreview(CDC* pdc, const CRect& rc, COLORREF color, const Options* options = nullptr);
 
 protected:
-    // The recursive drawing function
-    void RecurseDrawGraph(
-        CColorRefArray& bitmap,
-        Item* item,
+    //
+    // Snapshot. The part of the tree the layout has reached, copied into
+    // flat arrays so that the children of every node are stored next to each
+    // other. A node gets its children only once its rectangle is drawn in
+    // detail, so the snapshot grows with what is visible rather than with
+    // the tree; a subtree below the detail threshold stays one node with the
+    // color of its largest file. UpdateItems() appends the parts of the tree
+    // which changed and leaves the nodes it replaces behind with a null item.
+    //
+    struct Snapshot
+    {
+        std::vector<Item*> items;
+        std::vector<ULONGLONG> sizes;
+        std::vector<UINT> parents;    // UINT_MAX for the first node
+        std::vector<UINT> firstChild; // UINT_MAX until the children are copied
+        std::vector<UINT> childCount; // Zero for leaves and items without size
+        std::vector<COLORREF> colors; // Of the leaves and of the largest file below nodes not expanded
+        std::unordered_map<const Item*, UINT> nodes; // Node of every folder which has been expanded
+    };
+
+    //
+    // LayoutLeaf. A rectangle of the finished layout together with the
+    // cushion surface and color it is rasterised with. Items which are too
+    // small to be drawn besides the grid are kept as well for hit testing.
+    //
+    struct LayoutLeaf
+    {
+        CRect rc;
+        double surface[4];
+        COLORREF color;
+        UINT node;
+    };
+
+    // A subtree whose layout is left to the render threads
+    struct LayoutJob
+    {
+        UINT node;
+        CRect rc;
+        double surface[4];
+        double h;
+        std::vector<LayoutLeaf> leaves;
+    };
+
+    // A subtree which has to be laid out again after UpdateItems()
+    struct DirtyRegion
+    {
+        UINT node;
+        CRect rc;
+        double surface[4];
+        double h;
+    };
+
+    // A run of leaves, or some rows of a single large leaf, for one render thread
+    struct RasterBatch
+    {
+        size_t first;
+        size_t last;
+        int top;
+        int bottom;
+    };
+
+    // Identifies a piece of the raster of a view
+    struct TileKey
+    {
+        Item* root;
+        LONG width;
+        LONG height;
+        Options options;
+        int column;
+        int row;
+
+        bool operator==(const TileKey&) const = default;
+    };
+
+    struct TileKeyHash
+    {
+        size_t operator()(const TileKey& key) const;
+    };
+
+    // A rasterised tile kept for when its view is shown again
+    struct RasterTile
+    {
+        TileKey key;
+        std::vector<COLORREF> bits;
+    };
+
+    // Everything the layout depends on besides the tree itself
+    struct LayoutKey
+    {
+        Item* root;
+        LONG width;
+        LONG height;
+        STYLE style;
+        bool grid;
+        double cushionHeight;
+        double scaleFactor;
+        int detailArea;
+
+        bool operator==(const LayoutKey&) const = default;
+    };
+
+    // Lays out the tree unless the current layout was made for the same key
+    void UpdateLayout(Item* root, const CRect& rc);
+
+    // Starts a new m_snapshot with root alone
+    void BuildSnapshot(Item* root);
+
+    // Appends a node for item to the snapshot and returns its index
+    UINT AddNode(Item* item, UINT parent);
+
+    // Removes the item of node from the snapshot
+    void ForgetNode(UINT node);
+
+    // Whether the children of node have been copied into the snapshot
+    bool IsExpanded(UINT node) const;
+
+    // Appends the children of node to the snapshot
+    void ExpandNode(UINT node);
+
+    // Expands the subtree below node as far as it will be drawn in detail
+    // when laid out in a rectangle of the given area
+    void ExpandForArea(UINT node, double area);
+
+    // Drops the subtree below node, it is copied again once it is laid out
+    void ReloadNode(UINT node);
+
+    // Detaches all nodes below node from the snapshot
+    void ReleaseNodes(UINT node);
+
+    // Takes over the new sizes of the children of node, which is an ancestor
+    // of a changed item. Returns false if the children were added, removed or
+    // reordered, so that the subtree has to be laid out again.
+    bool ReloadChildren(UINT node);
+
+    // Collects the subtrees below node which have to be laid out again.
+    // Returns false if that is the case for the whole layout.
+    bool FindDirtyRegions(
+        std::vector<DirtyRegion>& dirty,
+        UINT node,
         const CRect& rc,
         bool asroot,
         const double* psurface,
         double h,
-        DWORD flags
+        const std::vector<bool>& touched,
+        const std::vector<bool>& changed
     );
 
-    // This function switches to KDirStat-, SequoiaView- or Simple_DrawChildren
-    void DrawChildren(
-        CColorRefArray& bitmap,
-        Item* parent,
+    // The recursive layout function
+    void RecurseLayout(
+        std::vector<LayoutLeaf>& leaves,
+        UINT node,
+        const CRect& rc,
+        bool asroot,
+        const double* psurface,
+        double h
+    );
+
+    // Returns the color of the largest file below node, which stands for the
+    // whole subtree, or CLR_INVALID if a render thread cannot look it up
+    COLORREF GetDominantColor(UINT node);
+
+    // This function switches to KDirStat- or SequoiaView_LayoutChildren
+    void LayoutChildren(
+        std::vector<LayoutLeaf>& leaves,
+        UINT parent,
+        const CRect& rc,
         const double* surface,
-        double h,
-        DWORD flags
+        double h
     );
 
     // KDirStat-like squarification
-    void KDirStat_DrawChildren(CColorRefArray& bitmap, Item* parent, const double* surface, double h, DWORD flags);
-    bool KDirStat_ArrangeChildren(Item* parent, CArray<double, double>& childWidth, CArray<double, double>& rows, CArray<int, int>& childrenPerRow);
-    double KDirStat_CalculateNextRow(Item* parent, int nextChild, double width, int& childrenUsed, CArray<double, double>& childWidth);
+    void KDirStat_LayoutChildren(std::vector<LayoutLeaf>& leaves, UINT parent, const CRect& rc, const double* surface, double h);
+    bool KDirStat_ArrangeChildren(UINT parent, const CRect& parentRect, CArray<double, double>& childWidth, CArray<double, double>& rows, CArray<int, int>& childrenPerRow);
+    double KDirStat_CalculateNextRow(UINT parent, int nextChild, double width, int& childrenUsed, CArray<double, double>& childWidth);
 
     // Classical SequoiaView-like squarification
-    void SequoiaView_DrawChildren(CColorRefArray& bitmap, Item* parent, const double* surface, double h, DWORD flags);
+    void SequoiaView_LayoutChildren(std::vector<LayoutLeaf>& leaves, UINT parent, const CRect& parentRect, const double* surface, double h);
+
+    // Records which leaf covers each pixel of the current layout
+    void BuildHitMap();
+
+    // Splits the leaves into batches of roughly the same number of pixels
+    void BuildRasterBatches(unsigned int threads);
+
+    // Fills the bitmap from the current layout
+    void RasterizeLayout(CColorRefArray& bitmap);
+
+    // Brings m_bits up to date with the current layout and options
+    void UpdateRaster();
+
+    // Returns the tiles the current view is divided into
+    std::vector<CRect> GetTiles() const;
+
+    TileKey GetTileKey(const CRect& tile) const;
+
+    // Copies the cached tiles of the current view into bitmap and returns the missing ones
+    std::vector<CRect> LoadTiles(CColorRefArray& bitmap);
+
+    // Puts the given tiles of bitmap into the cache, dropping the least recently used beyond the budget
+    void StoreTiles(const CColorRefArray& bitmap, const std::vector<CRect>& tiles);
+
+    // Renders only the given tiles of the current layout
+    void RasterizeTiles(CColorRefArray& bitmap, const std::vector<CRect>& tiles);
+
+    // Empties the tile cache; must be done whenever the tree has changed
+    void DropTiles();
 
     // Sets brightness to a good value, if system has only 256 colors
     void SetBrightnessFor256();
@@ -256,8 +465,8 @@ protected:
     // Returns true, if height and scaleFactor are > 0 and ambientLight is < 1.0
     bool IsCushionShading() const;
 
-    // Leaves space for grid and then calls RenderRectangle()
-    void RenderLeaf(CColorRefArray& bitmap, Item* item, const double* surface);
+    // Leaves space for grid and then calls RenderRectangle() for the part inside clip
+    void RenderLeaf(CColorRefArray& bitmap, const LayoutLeaf& leaf, const CRect& clip);
 
     // Either calls DrawCushion() or DrawSolidRect()
     void RenderRectangle(CColorRefArray& bitmap, const CRect& rc, const double* surface, DWORD color);
@@ -279,6 +488,28 @@ protected:
 
     CRect m_renderArea;
 
+    Snapshot m_snapshot;                      // Input of the layout
+    LayoutKey m_layoutKey = {};               // What m_layout was computed for
+    bool m_layoutValid = false;
+    bool m_itemsDetached = false;             // Items of m_snapshot may have been freed
+    std::vector<LayoutLeaf> m_layout;         // The leaves of the current layout
+    std::vector<RasterBatch> m_rasterBatches; // The same leaves divided up for the render threads
+    UINT m_rootNode = 0;                      // Node of the root item of the current layout
+    std::vector<UINT> m_hitMap;               // Node per pixel, built by the first FindItemByPoint()
+
+    std::vector<LayoutJob>* m_jobs = nullptr; // Collects subtrees during the layout pass of a parallel render
+    int m_jobArea = 0;                        // Subtrees up to this many pixels become a job of their own
+    bool m_snapshotFrozen = false;            // Set while the render threads lay out, see RecurseLayout()
+    std::vector<std::pair<UINT, CRect>>* m_probe = nullptr; // Collects the child rectangles instead of laying them out
+
+    CColorRefArray m_bits;                    // The current layout rasterised
+    Options m_bitsOptions = {};               // What m_bits was rasterised with
+    CRect m_dirtyArea;                        // The part of m_bits which no longer matches the layout
+
+    std::list<RasterTile> m_tiles;            // Tiles of recent views, most recently used first
+    std::unordered_map<TileKey, std::list<RasterTile>::iterator, TileKeyHash> m_tileIndex;
+    size_t m_tileBytes = 0;                   // Memory held by m_tiles
+
     Options m_options; // Current options
     double m_Lx;       // Derived parameters
     double m_Ly;
@@ -24,6 +24,7 @@
 #include "Item.h"
 #include "MainFrame.h"
 #include "DirStatDoc.h"
+#include "ExtensionTable.h"
 #include <common/CommonHelpers.h>
 #include "TypeView.h"
 #include "GlobalHelpers.h"
@@ -286,11 +287,11 @@ void CExtensionListControl::SetExtensionData(const CExtensionData* ed)
     POSITION pos = ed->GetStartPosition();
     while (pos != nullptr)
     {
-        CStringW ext;
+        ULONG ext;
         SExtensionRecord r;
         ed->GetNextAssoc(pos, ext, r);
 
-        auto item = new CListItem(this, ext, r);
+        auto item = new CListItem(this, ExtensionTable::GetName(ext), r);
         InsertListItem(i++, item);
     }
 
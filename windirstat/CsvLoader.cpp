@@ -25,14 +25,19 @@
 #include "Localization.h"
 #include "CsvLoader.h"
 #include "GlobalHelpers.h"
+#include "SmartPointer.h"
 
-#include <fstream>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <future>
 #include <string>
+#include <string_view>
 #include <stack>
-#include <sstream>
 #include <map>
-#include <format>
-#include <chrono>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
 
 enum
 {
@@ -47,6 +52,24 @@ enum
     FIELD_COUNT
 };
 
+constexpr size_t MAX_FIELDS = 16;
+constexpr size_t MIN_CHUNK_SIZE = 4 * 1024 * 1024;
+constexpr size_t WRITE_BUFFER_SIZE = 4 * 1024 * 1024;
+
+// Item created from a line along with its full path inside the mapped file
+struct ParsedRow
+{
+    std::string_view path;
+    CItem* item;
+};
+
+struct ParsedChunk
+{
+    std::vector<ParsedRow> rows;
+    size_t containers = 0;
+    bool success = true;
+};
+
 CHAR order_map[FIELD_COUNT];
 static void ParseHeaderLine(std::vector<std::wstring> header)
 {
@@ -73,158 +96,417 @@ static void ParseHeaderLine(std::vector<std::wstring> header)
     }
 }
 
-static std::chrono::file_clock::time_point ToTimePoint(const FILETIME& ft)
+// Parses the "YYYY-MM-DDTHH:MM:SS[.fffffff]Z" time stamps written by SaveResults
+static FILETIME FromTimeString(const std::string_view s)
 {
-    std::chrono::file_clock::duration d{ (static_cast<int64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime };
-    return std::chrono::file_clock::time_point { d };
+    bool valid = s.size() >= 19 && s[4] == '-' && s[7] == '-' && s[10] == 'T' && s[13] == ':' && s[16] == ':';
+    const auto digits = [&](const size_t pos, const size_t count)
+    {
+        WORD value = 0;
+        for (size_t i = pos; valid && i < pos + count; i++)
+        {
+            valid = s[i] >= '0' && s[i] <= '9';
+            value = static_cast<WORD>(value * 10 + (s[i] - '0'));
+        }
+        return value;
+    };
+
+    SYSTEMTIME st = {};
+    st.wYear = digits(0, 4);
+    st.wMonth = digits(5, 2);
+    st.wDay = digits(8, 2);
+    st.wHour = digits(11, 2);
+    st.wMinute = digits(14, 2);
+    st.wSecond = digits(17, 2);
+
+    FILETIME ft = {};
+    if (!valid || !SystemTimeToFileTime(&st, &ft)) return {};
+
+    // Add fractional seconds down to the 100ns resolution of FILETIME
+    ULONGLONG fraction = 0;
+    int scale = 7;
+    for (size_t i = 20; s.size() > 19 && s[19] == '.' && i < s.size() && s[i] >= '0' && s[i] <= '9'; i++)
+    {
+        if (scale == 0) continue;
+        fraction = fraction * 10 + (s[i] - '0');
+        scale--;
+    }
+    while (scale-- > 0 && fraction > 0) fraction *= 10;
+
+    ULARGE_INTEGER ticks = { { ft.dwLowDateTime, ft.dwHighDateTime } };
+    ticks.QuadPart += fraction;
+    return { ticks.LowPart, ticks.HighPart };
 }
 
-static FILETIME FromTimeString(std::wstring s)
+template <typename T>
+static T FromNumberString(std::string_view s, const int base)
 {
-    // Parse date string
-    std::wistringstream in{ s };
-    std::chrono::file_clock::time_point tp;
-    in >> std::chrono::parse(L"%Y-%m-%dT%H:%M:%S%Z", tp);
-
-    // Adjust time divisor to 100ns 
-    auto tmp = std::chrono::duration_cast<std::chrono::duration<int64_t,
-        std::ratio_multiply<std::hecto, std::nano>>>(tp.time_since_epoch()).count();
-
-    // Load into file time structure
-    FILETIME ft;
-    ft.dwLowDateTime = static_cast<ULONG>(tmp);
-    ft.dwHighDateTime = tmp >> 32;
-    return ft;
+    if (base == 16 && s.size() >= 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) s.remove_prefix(2);
+    T value = 0;
+    std::from_chars(s.data(), s.data() + s.size(), value, base);
+    return value;
 }
 
-static std::string QuoteAndConvert(const CStringW& inc)
+// Splits a line into its fields; quotes only ever surround complete fields
+static bool SplitFields(const std::string_view line, std::array<std::string_view, MAX_FIELDS>& fields, size_t& count)
 {
-    const int sz = WideCharToMultiByte(CP_UTF8, WC_NO_BEST_FIT_CHARS, inc.GetString(), -1, nullptr, 0, NULL, NULL);
-    std::string out = "\"";
-    out.resize(sz + 1);
-    WideCharToMultiByte(CP_UTF8, 0, inc.GetString(), -1, &out[1], sz, NULL, NULL);
-    out[sz] = '"';
-    return out;
+    count = 0;
+    for (size_t pos = 0; pos < line.length() && count < fields.size(); pos++)
+    {
+        size_t end;
+        if (line[pos] == '"')
+        {
+            end = line.find('"', ++pos);
+            if (end == std::string_view::npos) return false;
+            fields[count++] = line.substr(pos, end - pos);
+            end++;
+        }
+        else
+        {
+            end = line.find(',', pos);
+            if (end == std::string_view::npos) end = line.length();
+            fields[count++] = line.substr(pos, end - pos);
+        }
+        pos = end;
+    }
+    return true;
 }
 
-CItem* LoadResults(std::wstring path)
+// Creates the items for all lines of a chunk; linking them is left to the caller
+static void ParseChunk(const std::string_view chunk, ParsedChunk& result)
 {
-    std::ifstream reader(path);
-    if (!reader.is_open()) return nullptr;
-
-    CItem* newroot = nullptr;
-    std::string linebuf;
-    std::wstring line;
-    std::unordered_map<const std::wstring, CItem*, std::hash<std::wstring>> parent_map;
-
-    bool header_processed = false;
-    while (std::getline(reader, linebuf))
+    std::array<std::string_view, MAX_FIELDS> fields;
+    std::wstring name;
+    for (size_t pos = 0; pos < chunk.length();)
     {
-        if (linebuf.empty()) continue;
-        std::vector<std::wstring> fields;
+        size_t end = chunk.find('\n', pos);
+        if (end == std::string_view::npos) end = chunk.length();
+        std::string_view line = chunk.substr(pos, end - pos);
+        pos = end + 1;
 
-        // Convert to wide string
-        line.resize(linebuf.size() + 1);
-        const int size = MultiByteToWideChar(CP_UTF8, 0, linebuf.c_str(), -1,
-            line.data(), static_cast<int>(line.size()));
-        line.resize(size);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (line.empty()) continue;
 
-        // Parse all fields
-        for (size_t pos = 0; pos < line.length(); pos++)
+        // Parse all fields and make sure all necessary ones are present
+        size_t count;
+        if (!SplitFields(line, fields, count))
         {
-            const size_t comma = line.find(L',', pos);
-            size_t end = comma == std::wstring::npos ? line.length() : comma;
-
-            // Adjust for quoted lines
-            bool quoted = line.at(pos) == '"';
-            if (quoted)
+            result.success = false;
+            return;
+        }
+        for (int i = 0; i < FIELD_COUNT; i++)
+        {
+            if (i != FIELD_OWNER && static_cast<size_t>(order_map[i]) >= count)
             {
-                pos = pos + 1;
-                end = line.find('"', pos);
-                if (end == std::wstring::npos) return nullptr;
+                result.success = false;
+                return;
             }
-
-            // Extra value(s)
-            fields.emplace_back(line, pos, end - pos);
-            pos = end + (quoted ? 1 : 0);
         }
 
-        // Process the header if not done already
-        if (!header_processed)
+        // Determine how to store the path if it was the root or not
+        auto type = FromNumberString<USHORT>(fields[order_map[FIELD_ATTRIBUTES_WDS]], 16);
+        const bool use_full_path = type & (ITF_ROOTITEM | IT_DRIVE | IT_UNKNOWN | IT_FREESPACE);
+        const std::string_view path = fields[order_map[FIELD_NAME]];
+        std::string_view display_name = path;
+        if (const size_t slash = path.rfind('\\'); !use_full_path && slash != std::string_view::npos)
         {
-            ParseHeaderLine(fields);
-            header_processed = true;
-
-            // Validate all necessary fields are present
-            for (int i = 0; i < _countof(order_map); i++)
-            {
-                if (i != FIELD_OWNER && order_map[i] == -1) return NULL;
-            }
-            continue;
+            display_name = path.substr(slash + 1);
         }
 
-        // Decode item type
-        const ITEMTYPE type = static_cast<ITEMTYPE>(wcstoul(fields[order_map[FIELD_ATTRIBUTES_WDS]].c_str(), nullptr, 16));
+        // Convert to wide string; the result never has more characters than bytes
+        name.resize(display_name.length() + 1);
+        const int size = display_name.empty() ? 0 : MultiByteToWideChar(CP_UTF8, 0, display_name.data(),
+            static_cast<int>(display_name.length()), name.data(), static_cast<int>(name.size()));
+        name[size] = L'\0';
 
-        // Determine how to store the path if it was the root or not
-        const bool is_root = (type & ITF_ROOTITEM);
-        const bool is_in_root = (type & IT_DRIVE) || (type & IT_UNKNOWN) || (type & IT_FREESPACE);
-        const bool use_full_path = is_root || is_in_root;
-        const std::wstring map_path = fields[order_map[FIELD_NAME]];
-        LPWSTR lookup_path = fields[order_map[FIELD_NAME]].data();
-        LPWSTR display_name = use_full_path ? lookup_path : wcsrchr(lookup_path, L'\\');
-        if (!use_full_path && display_name != nullptr)
+        // Containers are marked as done once all their children have been added
+        const bool container = !(type & (IT_FILE | IT_FREESPACE | IT_UNKNOWN));
+        if (container)
         {
-            display_name[0] = L'\0';
-            display_name = &display_name[1];
+            type = static_cast<USHORT>(type & ~ITF_DONE);
+            result.containers++;
         }
 
         // Create the tree item
-        CItem* newitem = new CItem(
-            type,
-            display_name,
+        const auto newitem = new CItem(
+            static_cast<ITEMTYPE>(type),
+            name.c_str(),
             FromTimeString(fields[order_map[FIELD_LASTCHANGE]]),
-            _wcstoui64(fields[order_map[FIELD_SIZE]].c_str(), nullptr, 10),
-            wcstoul(fields[order_map[FIELD_ATTRIBUTES]].c_str(), nullptr, 16),
-            wcstoul(fields[order_map[FIELD_FILES]].c_str(), nullptr, 10),
-            wcstoul(fields[order_map[FIELD_SUBDIRS]].c_str(), nullptr, 10));
-        if (is_root) newroot = newitem;
-
-        auto parent = parent_map.find(lookup_path);
-        if (parent != parent_map.end())
+            FromNumberString<ULONGLONG>(fields[order_map[FIELD_SIZE]], 10),
+            FromNumberString<DWORD>(fields[order_map[FIELD_ATTRIBUTES]], 16),
+            FromNumberString<ULONG>(fields[order_map[FIELD_FILES]], 10),
+            FromNumberString<ULONG>(fields[order_map[FIELD_SUBDIRS]], 10));
+        result.rows.push_back({ path, newitem });
+    }
+}
+
+static void AppendUtf8(std::string& out, const std::wstring_view s)
+{
+    if (s.empty()) return;
+
+    // Three bytes per UTF-16 code unit is the worst case
+    const size_t offset = out.size();
+    out.resize(offset + s.length() * 3);
+    const int size = WideCharToMultiByte(CP_UTF8, 0, s.data(), static_cast<int>(s.length()),
+        &out[offset], static_cast<int>(s.length() * 3), nullptr, nullptr);
+    out.resize(offset + size);
+}
+
+static void AssignWide(std::wstring& out, const std::string_view s)
+{
+    // Never more UTF-16 code units than UTF-8 bytes
+    out.resize(s.length());
+    const int size = s.empty() ? 0 : MultiByteToWideChar(CP_UTF8, 0, s.data(),
+        static_cast<int>(s.length()), out.data(), static_cast<int>(out.size()));
+    out.resize(size);
+}
+
+static void AppendQuoted(std::string& out, const std::wstring_view s)
+{
+    out += '"';
+    AppendUtf8(out, s);
+    out += '"';
+}
+
+static void AppendNumber(std::string& out, const ULONGLONG value)
+{
+    char buffer[20];
+    out.append(buffer, std::to_chars(std::begin(buffer), std::end(buffer), value).ptr);
+}
+
+static void AppendHex(std::string& out, const ULONG value, const int digits)
+{
+    out += "0x";
+    for (int i = digits - 1; i >= 0; i--)
+    {
+        out += "0123456789ABCDEF"[value >> (i * 4) & 0xF];
+    }
+}
+
+// Writes the "YYYY-MM-DDTHH:MM:SS.fffffffZ" time stamps read by FromTimeString
+static void AppendTime(std::string& out, const FILETIME& ft)
+{
+    SYSTEMTIME st = {};
+    FileTimeToSystemTime(&ft, &st);
+    const ULONG fraction = static_cast<ULONG>((static_cast<ULONGLONG>(ft.dwHighDateTime) << 32 | ft.dwLowDateTime) % 10000000);
+
+    char buffer[32];
+    char* p = buffer;
+    const auto digits = [&p](ULONG value, const int count)
+    {
+        for (int i = count - 1; i >= 0; i--, value /= 10)
         {
-            parent->second->AddChild(newitem, true);
+            p[i] = static_cast<char>('0' + value % 10);
         }
-        else if (is_in_root)
+        p += count;
+    };
+    digits(st.wYear, 4);
+    *p++ = '-';
+    digits(st.wMonth, 2);
+    *p++ = '-';
+    digits(st.wDay, 2);
+    *p++ = 'T';
+    digits(st.wHour, 2);
+    *p++ = ':';
+    digits(st.wMinute, 2);
+    *p++ = ':';
+    digits(st.wSecond, 2);
+    *p++ = '.';
+    digits(fraction, 7);
+    *p++ = 'Z';
+    out.append(buffer, p);
+}
+
+//
+// CsvWriter. Collects the output in a large buffer which is handed to a
+// background thread for writing while the next one is being filled.
+//
+class CsvWriter final
+{
+    HANDLE m_file;
+    std::string m_buffer;
+    std::string m_writing;
+    std::future<bool> m_write;
+    bool m_success = true;
+
+    void Wait()
+    {
+        if (m_write.valid()) m_success = m_write.get() && m_success;
+    }
+
+public:
+    explicit CsvWriter(HANDLE file) : m_file(file)
+    {
+        m_buffer.reserve(WRITE_BUFFER_SIZE);
+        m_writing.reserve(WRITE_BUFFER_SIZE);
+    }
+
+    ~CsvWriter()
+    {
+        Wait();
+    }
+
+    std::string& Buffer()
+    {
+        return m_buffer;
+    }
+
+    void Flush(const bool force = false)
+    {
+        if (m_buffer.size() < WRITE_BUFFER_SIZE && !force) return;
+
+        Wait();
+        std::swap(m_buffer, m_writing);
+        m_buffer.clear();
+        m_write = std::async(std::launch::async, [this]
+        {
+            DWORD written = 0;
+            return WriteFile(m_file, m_writing.data(), static_cast<DWORD>(m_writing.size()),
+                &written, nullptr) && written == m_writing.size();
+        });
+    }
+
+    bool Finish()
+    {
+        Flush(true);
+        Wait();
+        return m_success;
+    }
+};
+
+CItem* LoadResults(std::wstring path)
+{
+    const HANDLE handle = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) return nullptr;
+    SmartPointer<HANDLE> file(CloseHandle, handle);
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return nullptr;
+    SmartPointer<HANDLE> mapping(CloseHandle, CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr));
+    if (mapping == nullptr) return nullptr;
+    SmartPointer<LPVOID> view(UnmapViewOfFile, MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (view == nullptr) return nullptr;
+    const std::string_view data(static_cast<const char*>(static_cast<LPVOID>(view)), static_cast<size_t>(fileSize.QuadPart));
+
+    // Process the header
+    const size_t header_end = data.find('\n');
+    if (header_end == std::string_view::npos) return nullptr;
+    std::string_view header_line = data.substr(0, header_end);
+    if (!header_line.empty() && header_line.back() == '\r') header_line.remove_suffix(1);
+
+    std::array<std::string_view, MAX_FIELDS> header_fields;
+    size_t header_count;
+    if (!SplitFields(header_line, header_fields, header_count)) return nullptr;
+    std::vector<std::wstring> header;
+    for (size_t i = 0; i < header_count; i++)
+    {
+        header.emplace_back(CA2W(std::string(header_fields[i]).c_str(), CP_UTF8));
+    }
+    ParseHeaderLine(header);
+
+    // Validate all necessary fields are present
+    for (int i = 0; i < _countof(order_map); i++)
+    {
+        if (i != FIELD_OWNER && order_map[i] == -1) return nullptr;
+    }
+
+    // Split the remainder at line boundaries and parse the pieces in parallel
+    const std::string_view body = data.substr(header_end + 1);
+    const size_t threads = std::clamp<size_t>(body.length() / MIN_CHUNK_SIZE, 1,
+        std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::string_view> chunks;
+    for (size_t i = 1, start = 0; i <= threads; i++)
+    {
+        size_t end = i == threads ? body.length() : body.find('\n', std::max(start, body.length() * i / threads));
+        end = end == std::string_view::npos || end == body.length() ? body.length() : end + 1;
+        chunks.push_back(body.substr(start, end - start));
+        start = end;
+    }
+
+    std::vector<ParsedChunk> results(chunks.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        workers.emplace_back([&chunks, &results, i]
+        {
+            ParseChunk(chunks[i], results[i]);
+        });
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    if (!std::ranges::all_of(results, [](const auto& result) { return result.success; }))
+    {
+        for (const auto& result : results)
         {
-            newroot->AddChild(newitem, true);
+            for (const auto& row : result.rows) delete row.item;
         }
-        else ASSERT(FALSE);
+        return nullptr;
+    }
 
-        if (!newitem->TmiIsLeaf())
+    // Link the items to their parents in file order
+    CItem* newroot = nullptr;
+    std::vector<CItem*> orphans;
+    std::unordered_map<std::string_view, CItem*> parent_map;
+    parent_map.reserve(std::accumulate(results.begin(), results.end(), size_t{ 0 },
+        [](const size_t sum, const auto& result) { return sum + result.containers; }));
+    for (const auto& result : results)
+    {
+        for (const auto& [item_path, item] : result.rows)
         {
-            parent_map[map_path] = newitem;
+            CItem* parent = nullptr;
+            if (item->IsType(ITF_ROOTITEM))
+            {
+                newroot = item;
+            }
+            else if (item->IsType(IT_DRIVE | IT_UNKNOWN | IT_FREESPACE))
+            {
+                parent = newroot;
+            }
+            else if (const size_t slash = item_path.rfind('\\'); slash != std::string_view::npos)
+            {
+                const auto entry = parent_map.find(item_path.substr(0, slash));
+                if (entry != parent_map.end()) parent = entry->second;
+            }
 
-            // Special case: also add mapping for drive without backslash
-            if (newitem->IsType(IT_DRIVE)) parent_map[map_path.substr(0,2)] = newitem;
+            if (parent != nullptr) parent->AddChild(item, true);
+            else if (item != newroot) orphans.push_back(item);
+
+            if (!item->TmiIsLeaf())
+            {
+                parent_map[item_path] = item;
+
+                // Special case: also add mapping for drive without backslash
+                if (item->IsType(IT_DRIVE)) parent_map[item_path.substr(0, 2)] = item;
+            }
         }
     }
 
     // Sort all parent items
-    for (auto const& item : parent_map)
+    for (auto result = results.rbegin(); result != results.rend(); ++result)
     {
-        item.second->UpwardSetUndone();
-        item.second->SetDone();
+        for (auto row = result->rows.rbegin(); row != result->rows.rend(); ++row)
+        {
+            if (!row->item->TmiIsLeaf()) row->item->SetDone();
+        }
     }
 
+    // Items whose parent never showed up cannot be placed anywhere
+    ASSERT(orphans.empty());
+    for (const auto& orphan : orphans) delete orphan;
     return newroot;
 }
 
 bool SaveResults(std::wstring path, CItem * item)
 {
-    // Output header line to file
-    std::ofstream outf;
-    outf.open(path, std::ios::binary);
+    const HANDLE handle = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+    SmartPointer<HANDLE> file(CloseHandle, handle);
+    CsvWriter writer(file);
 
     // Determine columns
     std::vector<CStringW> cols =
@@ -245,47 +527,90 @@ bool SaveResults(std::wstring path, CItem * item)
     // Output columns to file
     for (unsigned int i = 0; i < cols.size(); i++)
     {
-        outf << QuoteAndConvert(cols[i]) << ((i < cols.size() - 1) ? "," : "");
+        AppendQuoted(writer.Buffer(), cols[i].GetString());
+        writer.Buffer() += (i < cols.size() - 1) ? "," : "\r\n";
     }
 
-    // Output all items to file
-    outf << "\r\n";
-    std::stack<CItem*> queue;
-    queue.push(item);
+    // Output all items to file; the path of the current item is kept in
+    // UTF-8 and every item on the stack knows how much of it its parent owns
+    std::string item_path;
+    std::wstring owner_path;
+    std::stack<std::pair<const CItem*, size_t>> queue;
+    queue.emplace(item, 0);
     while (!queue.empty())
     {
         // Grab item from queue
-        const CItem* qitem = queue.top();
+        const auto [qitem, parent_length] = queue.top();
         queue.pop();
 
+        // Extend the path of the parent; drives always start a new one
+        item_path.resize(parent_length);
+        if (qitem->IsType(IT_DRIVE))
+        {
+            item_path.clear();
+            AppendUtf8(item_path, PathFromVolumeName(qitem->GetName()).GetString());
+        }
+        else if (qitem->IsType(IT_DIRECTORY | IT_FILE))
+        {
+            if (!item_path.empty()) item_path += '\\';
+            AppendUtf8(item_path, qitem->GetNameView());
+        }
+
         // Output primary columns
-        const bool non_path_item = qitem->IsType(ITF_ROOTITEM | IT_UNKNOWN | IT_FREESPACE);
-        outf << std::format("{},{},{},{},0x{:08X},{:%FT%TZ},0x{:04X}",
-            QuoteAndConvert(non_path_item ? qitem->GetName() : qitem->GetPath()),
-            qitem->GetFilesCount(),
-            qitem->GetSubdirsCount(),
-            qitem->GetSize(),
-            qitem->GetAttributes(),
-            ToTimePoint(qitem->GetLastChange()),
-            static_cast<unsigned short>(qitem->GetRawType()));
+        std::string& out = writer.Buffer();
+        if (qitem->IsType(ITF_ROOTITEM | IT_UNKNOWN | IT_FREESPACE))
+        {
+            AppendQuoted(out, qitem->GetNameView());
+        }
+        else
+        {
+            out += '"';
+            out += item_path;
+            if (qitem->IsType(IT_DRIVE)) out += '\\';
+            out += '"';
+        }
+        out += ',';
+        AppendNumber(out, qitem->GetFilesCount());
+        out += ',';
+        AppendNumber(out, qitem->GetSubdirsCount());
+        out += ',';
+        AppendNumber(out, qitem->GetSize());
+        out += ',';
+        AppendHex(out, qitem->GetAttributes(), 8);
+        out += ',';
+        AppendTime(out, qitem->GetLastChange());
+        out += ',';
+        AppendHex(out, static_cast<unsigned short>(qitem->GetRawType()), 4);
 
         // Output additional columns
         if (COptions::ShowColumnOwner)
         {
-            outf << "," << QuoteAndConvert(qitem->GetOwner(true));
+            // Owners not read while scanning are read through the path
+            // built above instead of having the item assemble it again
+            out += ',';
+            if (qitem->IsType(IT_DIRECTORY | IT_FILE | IT_DRIVE))
+            {
+                AssignWide(owner_path, item_path);
+                if (qitem->IsType(IT_DRIVE)) owner_path += L'\\';
+                AppendQuoted(out, qitem->GetOwner(owner_path.c_str()).GetString());
+            }
+            else
+            {
+                AppendQuoted(out, qitem->GetOwner(true).GetString());
+            }
         }
 
         // Finalize lines
-        outf << "\r\n";
+        out += "\r\n";
+        writer.Flush();
 
         // Descend into childitems
         if (qitem->IsType(IT_FILE)) continue;
         for (const auto& child : qitem->GetChildren())
         {
-            queue.push(child);
+            queue.emplace(child, item_path.size());
         }
     }
 
-    outf.close();
-    return true;
+    return writer.Finish();
 }
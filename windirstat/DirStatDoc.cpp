@@ -45,6 +45,7 @@
 #include "GraphView.h"
 #include "Localization.h"
 #include <CsvLoader.h>
+#include <SnapshotLoader.h>
 
 CDirStatDoc* _theDocument;
 
@@ -179,9 +180,29 @@ WCHAR CDirStatDoc::GetEncodingSeparator()
 void CDirStatDoc::DeleteContents()
 {
     ShutdownCoordinator();
+
+    // A progressive treemap must no longer read the tree (the frame is gone on exit)
+    if (GetMainFrame() != nullptr)
+    {
+        GetMainFrame()->GetGraphView()->StopProgressiveDrawing();
+    }
+
+    const bool hadTree = m_rootItem != nullptr;
     delete m_rootItem;
     m_rootItem = nullptr;
     m_zoomItem = nullptr;
+
+    m_extensionTotals.clear();
+    m_extensionTotalsValid = true;
+
+    // Owners and icons still being looked up belong to the old tree
+    OwnerTable::ClearPending();
+    GetMyImageList()->clearPending();
+
+    // With the whole tree gone the node slabs can be handed back at once;
+    // without one there may be a loaded tree waiting to become the root
+    // (see OnLoadResults()) which lives in the very same slabs
+    if (hadTree) CItem::PurgeAllocations();
     GetWDSApp()->ReReadMountPoints();
 }
 
@@ -245,7 +266,15 @@ BOOL CDirStatDoc::OnOpenDocument(LPCWSTR lpszPathName)
     }
     m_zoomItem = m_rootItem;
 
-    GetMainFrame()->MinimizeGraphView();
+    // Progressive treemaps are shown while scanning, otherwise there is nothing to see
+    if (COptions::TreeMapProgressive)
+    {
+        GetMainFrame()->RestoreGraphView();
+    }
+    else
+    {
+        GetMainFrame()->MinimizeGraphView();
+    }
     GetMainFrame()->MinimizeTypeView();
 
     UpdateAllViews(nullptr, HINT_NEWROOT);
@@ -255,11 +284,14 @@ BOOL CDirStatDoc::OnOpenDocument(LPCWSTR lpszPathName)
 
 BOOL CDirStatDoc::OnOpenDocument(CItem * newroot)
 {
-    CDocument::OnNewDocument(); // --> DeleteContents()
+    CDocument::OnNewDocument(); // --> DeleteContents(), which leaves newroot alone
 
     m_rootItem = newroot;
     m_zoomItem = m_rootItem;
 
+    // Loaded files did not pass through the scanning threads
+    m_extensionTotalsValid = false;
+
     GetMainFrame()->MinimizeGraphView();
     GetMainFrame()->MinimizeTypeView();
 
@@ -292,7 +324,7 @@ void CDirStatDoc::SetTitlePrefix(const CStringW& prefix) const
     GetMainFrame()->UpdateFrameTitleForDocument(docName);
 }
 
-COLORREF CDirStatDoc::GetCushionColor(LPCWSTR ext)
+COLORREF CDirStatDoc::GetCushionColor(const ULONG ext)
 {
     SExtensionRecord r;
     VERIFY(GetExtensionData()->Lookup(ext, r));
@@ -313,6 +345,40 @@ const CExtensionData* CDirStatDoc::GetExtensionData()
     return &m_extensionData;
 }
 
+// Called by each scanning thread with the files it has added.
+//
+void CDirStatDoc::AddExtensionTotals(const CExtensionTotals& totals)
+{
+    std::lock_guard lock(m_extensionTotalsMutex);
+    if (totals.size() > m_extensionTotals.size()) m_extensionTotals.resize(totals.size());
+    for (size_t ext = 0; ext < totals.size(); ext++)
+    {
+        m_extensionTotals[ext].files += totals[ext].files;
+        m_extensionTotals[ext].bytes += totals[ext].bytes;
+    }
+}
+
+// Takes the files below item (or item itself) out of the totals
+// before they are pruned for a refresh.
+//
+void CDirStatDoc::SubtractExtensionTotals(const CItem* item)
+{
+    std::lock_guard lock(m_extensionTotalsMutex);
+    if (item == m_rootItem)
+    {
+        m_extensionTotals.clear();
+        return;
+    }
+
+    CExtensionTotals totals;
+    item->RecurseCollectExtensionData(totals);
+    for (size_t ext = 0; ext < totals.size() && ext < m_extensionTotals.size(); ext++)
+    {
+        m_extensionTotals[ext].files -= totals[ext].files;
+        m_extensionTotals[ext].bytes -= totals[ext].bytes;
+    }
+}
+
 ULONGLONG CDirStatDoc::GetRootSize() const
 {
     ASSERT(m_rootItem != NULL);
@@ -532,52 +598,68 @@ void CDirStatDoc::RefreshRecyclers() const
     if (!to_refresh.empty()) GetDocument()->StartupCoordinator(to_refresh);
 }
 
-void CDirStatDoc::RebuildExtensionData()
+// Returns true if an extension got a different cushion color.
+//
+bool CDirStatDoc::RebuildExtensionData()
 {
     CWaitCursor wc;
 
     m_extensionData.RemoveAll();
     if (IsRootDone())
     {
-        m_rootItem->RecurseCollectExtensionData(&m_extensionData);
+        std::lock_guard lock(m_extensionTotalsMutex);
+        if (!m_extensionTotalsValid)
+        {
+            m_extensionTotals.clear();
+            m_rootItem->RecurseCollectExtensionData(m_extensionTotals);
+            m_extensionTotalsValid = true;
+        }
+
+        for (ULONG ext = 0; ext < m_extensionTotals.size(); ext++)
+        {
+            if (m_extensionTotals[ext].files == 0) continue;
+            SExtensionRecord r = { m_extensionTotals[ext].files, m_extensionTotals[ext].bytes, 0 };
+            m_extensionData.SetAt(ext, r);
+        }
     }
-    
-    CStringArray sortedExtensions;
+
+    std::vector<ULONG> sortedExtensions;
     SortExtensionData(sortedExtensions);
-    SetExtensionColors(sortedExtensions);
+    const bool recolored = SetExtensionColors(sortedExtensions);
 
     m_extensionDataValid = true;
+    return recolored;
 }
 
-void CDirStatDoc::SortExtensionData(CStringArray& sortedExtensions)
+// Ranks the extensions by size; ties go to the lower id so that
+// the ranking (and thus the colors) is the same from run to run.
+//
+void CDirStatDoc::SortExtensionData(std::vector<ULONG>& sortedExtensions) const
 {
-    sortedExtensions.SetSize(m_extensionData.GetCount());
-
-    POSITION pos = m_extensionData.GetStartPosition();
-    for (int i = 0; pos != nullptr; i++)
+    std::vector<std::pair<ULONGLONG, ULONG>> records;
+    records.reserve(static_cast<size_t>(m_extensionData.GetCount()));
+    for (POSITION pos = m_extensionData.GetStartPosition(); pos != nullptr;)
     {
-        CStringW ext;
+        ULONG ext;
         SExtensionRecord r;
         m_extensionData.GetNextAssoc(pos, ext, r);
-
-        sortedExtensions[i] = ext;
+        records.emplace_back(r.bytes, ext);
     }
 
-    _pqsortExtensionData = &m_extensionData;
-    qsort(sortedExtensions.GetData(), sortedExtensions.GetSize(), sizeof(CStringW), [](LPCVOID item1, LPCVOID item2)
+    std::ranges::sort(records, [](const auto& r1, const auto& r2)
     {
-        const CStringW* ext1 = static_cast<const CStringW*>(item1);
-        const CStringW* ext2 = static_cast<const CStringW*>(item2);
-        SExtensionRecord r1;
-        SExtensionRecord r2;
-        VERIFY(_pqsortExtensionData->Lookup(*ext1, r1));
-        VERIFY(_pqsortExtensionData->Lookup(*ext2, r2));
-        return usignum(r2.bytes, r1.bytes);
+        return r1.first != r2.first ? r1.first > r2.first : r1.second < r2.second;
     });
-    _pqsortExtensionData = nullptr;
+
+    sortedExtensions.clear();
+    sortedExtensions.reserve(records.size());
+    for (const auto& [bytes, ext] : records)
+    {
+        sortedExtensions.push_back(ext);
+    }
 }
 
-void CDirStatDoc::SetExtensionColors(const CStringArray& sortedExtensions)
+bool CDirStatDoc::SetExtensionColors(const std::vector<ULONG>& sortedExtensions)
 {
     static CArray<COLORREF, COLORREF&> colors;
 
@@ -586,18 +668,24 @@ void CDirStatDoc::SetExtensionColors(const CStringArray& sortedExtensions)
         CTreemap::GetDefaultPalette(colors);
     }
 
-    for (int i = 0; i < sortedExtensions.GetSize(); i++)
+    for (size_t i = 0; i < sortedExtensions.size(); i++)
     {
         COLORREF c = colors[colors.GetSize() - 1];
-        if (i < colors.GetSize())
+        if (i < static_cast<size_t>(colors.GetSize()))
         {
-            c = colors[i];
+            c = colors[static_cast<INT_PTR>(i)];
         }
         m_extensionData[sortedExtensions[i]].color = c;
     }
-}
 
-CExtensionData* CDirStatDoc::_pqsortExtensionData;
+    // All extensions beyond the top ones share the last color,
+    // so the colors only change if the top ranking does
+    const auto colored = std::vector(sortedExtensions.begin(), sortedExtensions.begin() +
+        min(sortedExtensions.size(), static_cast<size_t>(colors.GetSize() - 1)));
+    const bool recolored = colored != m_coloredExtensions;
+    m_coloredExtensions = colored;
+    return recolored;
+}
 
 // Deletes a file or directory via SHFileOperation.
 // Return: false, if canceled
@@ -955,24 +1043,36 @@ void CDirStatDoc::OnSaveResults()
 {
     // Request the file path from the user
     CStringW file_select_string;
-    file_select_string.Format(L"%s (*.csv)|*.csv|%s (*.*)|*.*||",
-        Localization::Lookup(IDS_CSV_FILES).GetString(), Localization::Lookup(IDS_ALL_FILES).GetString());
+    file_select_string.Format(L"%s (*.csv)|*.csv|%s (*.%s)|*.%s|%s (*.*)|*.*||",
+        Localization::Lookup(IDS_CSV_FILES).GetString(),
+        Localization::Lookup(IDS_SNAPSHOT_FILES).GetString(), SNAPSHOT_EXTENSION, SNAPSHOT_EXTENSION,
+        Localization::Lookup(IDS_ALL_FILES).GetString());
     CFileDialog dlg(FALSE, L"csv", nullptr, OFN_EXPLORER | OFN_DONTADDTORECENT, file_select_string.GetString());
     if (dlg.DoModal() != IDOK) return;
-    
-    SaveResults(dlg.GetPathName().GetString(), GetRootItem());
+
+    const std::wstring path = dlg.GetPathName().GetString();
+    if (IsSnapshotFile(path)) SaveSnapshot(path, GetRootItem());
+    else SaveResults(path, GetRootItem());
 }
 
 void CDirStatDoc::OnLoadResults()
 {
     // Request the file path from the user
     CStringW file_select_string;
-    file_select_string.Format(L"%s (*.csv)|*.csv|%s (*.*)|*.*||",
-        Localization::Lookup(IDS_CSV_FILES).GetString(), Localization::Lookup(IDS_ALL_FILES).GetString());
+    file_select_string.Format(L"%s (*.csv)|*.csv|%s (*.%s)|*.%s|%s (*.*)|*.*||",
+        Localization::Lookup(IDS_CSV_FILES).GetString(),
+        Localization::Lookup(IDS_SNAPSHOT_FILES).GetString(), SNAPSHOT_EXTENSION, SNAPSHOT_EXTENSION,
+        Localization::Lookup(IDS_ALL_FILES).GetString());
     CFileDialog dlg(TRUE, L"csv", nullptr, OFN_EXPLORER | OFN_DONTADDTORECENT | OFN_PATHMUSTEXIST, file_select_string.GetString());
     if (dlg.DoModal() != IDOK) return;
 
-    CItem* newroot = LoadResults(dlg.GetPathName().GetString());
+    // Release the current tree before the loaded one takes its
+    // allocations, as the old one can only be purged as a whole
+    DeleteContents();
+    UpdateAllViews(nullptr, HINT_NEWROOT);
+
+    const std::wstring path = dlg.GetPathName().GetString();
+    CItem* newroot = IsSnapshotFile(path) ? LoadSnapshot(path) : LoadResults(path);
     GetDocument()->OnOpenDocument(newroot);
 }
 
@@ -1158,17 +1258,13 @@ void CDirStatDoc::OnCleanupDeleteToBin()
     if (DeletePhysicalItems(items, true))
     {
         RefreshRecyclers();
-        UpdateAllViews(nullptr);
     }
 }
 
 void CDirStatDoc::OnCleanupDelete()
 {
     const auto & items = CTreeListControl::GetTheTreeListControl()->GetAllSelected<CItem>();
-    if (DeletePhysicalItems(items, false))
-    {
-        UpdateAllViews(nullptr);
-    }
+    DeletePhysicalItems(items, false);
 }
 
 void CDirStatDoc::OnUpdateUserDefinedCleanup(CCmdUI* pCmdUI)
@@ -1296,12 +1392,17 @@ void CDirStatDoc::StartupCoordinator(std::vector<CItem*> items)
     // Clear any reselection options since they may be invalidated
     ClearReselectChildStack();
 
-    // Do not attempt to update graph while scanning
+    // Do not attempt to update graph while scanning and
+    // do not let it hand out the items about to be pruned
     GetMainFrame()->GetGraphView()->SuspendRecalculationDrawing(true);
+    GetMainFrame()->GetGraphView()->DetachItems();
+
+    // Number the runs so the views can tell whether they missed one
+    const ULONG run = ++m_coordinatorRuns;
 
     // Start a thread so we do not hang the message loop
     // Lambda captures assume document exists for duration of thread
-    std::thread([this,items] () mutable
+    std::thread([this,items,run] () mutable
     {
         // Wait for other threads to finish if this was scheduled in parallel
         static std::shared_mutex mutex;
@@ -1310,6 +1411,8 @@ void CDirStatDoc::StartupCoordinator(std::vector<CItem*> items)
         const auto selected_items = CTreeListControl::GetTheTreeListControl()->GetAllSelected<CItem>();
         using visual_info = struct { bool wasExpanded; bool isSelected; int oldScrollPosition; };
         std::unordered_map<CItem *,visual_info> visualInfo;
+        std::vector<CItem*> changed; // What the views have to update when done
+        std::vector<CItem*> removed;
         for (auto item : std::vector(items))
         {
             // Record current visual arrangement to reapply afterward
@@ -1324,6 +1427,7 @@ void CDirStatDoc::StartupCoordinator(std::vector<CItem*> items)
             item->UpwardSubtractSize(item->GetSize());
             item->UpwardSubtractFiles(item->GetFilesCount());
             item->UpwardSubtractSubdirs(item->GetSubdirsCount());
+            SubtractExtensionTotals(item);
             item->RemoveAllChildren();
             item->SetExpanded(visualInfo[item].wasExpanded);
             item->UpwardSetUndone();
@@ -1351,10 +1455,18 @@ void CDirStatDoc::StartupCoordinator(std::vector<CItem*> items)
                 // Handle non-root item by removing from parent
                 item->UpwardSubtractFiles(item->IsType(IT_FILE) ? 1 : 0);
                 item->UpwardSubtractSubdirs(item->IsType(IT_FILE) ? 0 : 1);
+                changed.push_back(item->GetParent());
+                removed.push_back(item);
                 item->GetParent()->RemoveChild(item);
             }
         }
 
+        // Removed items are gone, the rest is rescanned in place
+        std::erase_if(changed, [&removed](const auto& item) { return std::ranges::find(removed, item) != removed.end(); });
+        changed.insert(changed.end(), items.begin(), items.end());
+        std::ranges::sort(changed);
+        changed.erase(std::ranges::unique(changed).begin(), changed.end());
+
         // Reset queue from last iteration
         const int max_threads = COptions::ScanningThreads;
         queue.reset(max_threads);
@@ -1370,17 +1482,31 @@ void CDirStatDoc::StartupCoordinator(std::vector<CItem*> items)
         // Create subordinate threads if there is work to do
         if (queue.has_items())
         {
+            // From here on the tree is only added to, so it can be drawn while scanning
+            GetMainFrame()->InvokeInMessageThread([]
+            {
+                GetMainFrame()->GetGraphView()->StartProgressiveDrawing();
+            });
+
+            // With the owner column shown owners are read for the whole tree
+            const bool owners = COptions::ShowColumnOwner;
             threads.clear();
             for (int i = 0; i < max_threads; i++)
             {
-                threads.emplace_back([this]
+                threads.emplace_back([this, owners]
                 {
-                    CItem::ScanItems(&queue);
+                    CItem::ScanItems(&queue, owners);
                 });
             }
 
             // Wait for all threads to run out of work
-            if (queue.wait_for_all())
+            const bool drained = queue.wait_for_all();
+            GetMainFrame()->InvokeInMessageThread([]
+            {
+                GetMainFrame()->GetGraphView()->StopProgressiveDrawing();
+            });
+
+            if (drained)
             {
                 // Exit here and stop progress if drained by an outside actor
                 GetMainFrame()->InvokeInMessageThread([]()
@@ -1420,16 +1546,24 @@ void CDirStatDoc::StartupCoordinator(std::vector<CItem*> items)
         CItem::ScanItemsFinalize(GetRootItem());
 
         // Invoke a UI thread to do updates
-        GetMainFrame()->InvokeInMessageThread([&items,&visualInfo]
+        GetMainFrame()->InvokeInMessageThread([this,&items,&visualInfo,&changed,run]
         {
+            // Names of the pruned subtrees are only reclaimed here where
+            // neither the scanners nor the painting can be using them
+            CItem::CompactNames(GetRootItem());
+
             for (const auto& item : items)
             {
                 item->SetScrollPosition(visualInfo[item].oldScrollPosition);
             }
 
+            // The views may only patch what changed if they saw the previous
+            // run finish and no cushion color changed in between
             GetMainFrame()->LockWindowUpdate();
-            GetDocument()->RebuildExtensionData();
-            GetDocument()->UpdateAllViews(nullptr);
+            const bool recolored = RebuildExtensionData();
+            const bool incremental = !recolored && !changed.empty() && run == m_lastFinishedRun + 1;
+            m_lastFinishedRun = run;
+            UpdateAllViews(nullptr, HINT_NULL, incremental ? reinterpret_cast<CObject*>(&changed) : nullptr);
             GetMainFrame()->SetProgressComplete();
             GetMainFrame()->RestoreTypeView();
             GetMainFrame()->RestoreGraphView();
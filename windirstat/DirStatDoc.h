@@ -25,6 +25,7 @@
 #include <common/Constants.h>
 #include "Options.h"
 
+#include <mutex>
 #include <vector>
 
 #include "BlockingQueue.h"
@@ -50,9 +51,23 @@ struct SExtensionRecord
 };
 
 //
-// Maps an extension (".bmp") to an SExtensionRecord.
+// Maps an extension id (see ExtensionTable) to an SExtensionRecord.
 //
-typedef CMap<CStringW, LPCWSTR, SExtensionRecord, SExtensionRecord&> CExtensionData;
+typedef CMap<ULONG, ULONG, SExtensionRecord, SExtensionRecord&> CExtensionData;
+
+//
+// Number and size of the files of one extension.
+//
+struct SExtensionTotal
+{
+    ULONGLONG files;
+    ULONGLONG bytes;
+};
+
+//
+// Running file totals indexed by extension id (see ExtensionTable).
+//
+typedef std::vector<SExtensionTotal> CExtensionTotals;
 
 //
 // Hints for UpdateAllViews()
@@ -94,10 +109,12 @@ public:
     void SetPathName(LPCWSTR lpszPathName, BOOL bAddToMRU) override;
     void SetTitlePrefix(const CStringW& prefix) const;
 
-    COLORREF GetCushionColor(LPCWSTR ext);
+    COLORREF GetCushionColor(ULONG ext);
     COLORREF GetZoomColor();
 
     const CExtensionData* GetExtensionData();
+    void AddExtensionTotals(const CExtensionTotals& totals);
+    void SubtractExtensionTotals(const CItem* item);
     ULONGLONG GetRootSize() const;
 
     static bool IsDrive(const CStringW& spec);
@@ -126,10 +143,9 @@ protected:
     void RecurseRefreshJunctionItems(CItem* item);
     std::vector<CItem*> GetDriveItems() const;
     void RefreshRecyclers() const;
-    void RebuildExtensionData();
-    void SortExtensionData(CStringArray& sortedExtensions);
-    void SetExtensionColors(const CStringArray& sortedExtensions);
-    static CExtensionData* _pqsortExtensionData;
+    bool RebuildExtensionData();
+    void SortExtensionData(std::vector<ULONG>& sortedExtensions) const;
+    bool SetExtensionColors(const std::vector<ULONG>& sortedExtensions);
     bool DeletePhysicalItems(std::vector<CItem*> items, bool toTrashBin);
     void SetZoomItem(CItem* item);
     static void AskForConfirmation(USERDEFINEDCLEANUP* udc, CItem* item);
@@ -157,11 +173,17 @@ protected:
 
     bool m_extensionDataValid;      // If this is false, m_extensionData must be rebuilt
     CExtensionData m_extensionData; // Base for the extension view and cushion colors
+    std::vector<ULONG> m_coloredExtensions; // Extensions with a palette color of their own, by rank
+    CExtensionTotals m_extensionTotals;     // Kept up to date by the scanning threads
+    bool m_extensionTotalsValid = true;     // False for loaded trees which were never scanned
+    std::mutex m_extensionTotalsMutex;      // Guards m_extensionTotals
 
     CList<CItem*, CItem*> m_reselectChildStack; // Stack for the "Re-select Child"-Feature
 
     BlockingQueue<CItem*> queue;      // The scanning queue
     std::vector<std::thread> threads; // For tracking threads
+    ULONG m_coordinatorRuns = 0;      // Number of refreshes started
+    ULONG m_lastFinishedRun = 0;      // Last refresh that updated the views
 
 protected:
     DECLARE_MESSAGE_MAP()
@@ -44,6 +44,8 @@ BEGIN_MESSAGE_MAP(CMyTreeListControl, CTreeListControl)
     ON_WM_SETFOCUS()
     ON_WM_KEYDOWN()
     ON_NOTIFY_EX(HDN_ENDDRAG, 0, OnHeaderEndDrag)
+    ON_MESSAGE(OwnerTable::WM_OWNERSRESOLVED, OnOwnersResolved)
+    ON_MESSAGE(CMyImageList::WM_IMAGESRESOLVED, OnImagesResolved)
 END_MESSAGE_MAP()
 
 BOOL CMyTreeListControl::OnHeaderEndDrag(UINT, NMHDR* pNMHDR, LRESULT* pResult)
@@ -55,6 +57,31 @@ BOOL CMyTreeListControl::OnHeaderEndDrag(UINT, NMHDR* pNMHDR, LRESULT* pResult)
     return block;
 }
 
+// Owners of visible rows have been looked up in the background; the
+// rows pick them up when they are drawn or sorted again.
+//
+LRESULT CMyTreeListControl::OnOwnersResolved(WPARAM, LPARAM)
+{
+    // Owners found from here on post another message; this one
+    // covers all of them found so far with a single sort
+    OwnerTable::Acknowledge(m_hWnd);
+    if (GetSorting().column1 == COL_OWNER || GetSorting().column2 == COL_OWNER)
+    {
+        Sort();
+    }
+    InvalidateRect(nullptr);
+    return 0;
+}
+
+// Rows still showing a placeholder pick up their icon when drawn again.
+//
+LRESULT CMyTreeListControl::OnImagesResolved(WPARAM, LPARAM)
+{
+    GetMyImageList()->acknowledgeResolved(m_hWnd);
+    InvalidateRect(nullptr);
+    return 0;
+}
+
 void CMyTreeListControl::OnContextMenu(CWnd* /*pWnd*/, CPoint pt)
 {
     const int i = GetSelectionMark();
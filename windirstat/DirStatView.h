@@ -48,6 +48,8 @@ protected:
     afx_msg void OnSetFocus(CWnd* pOldWnd);
     afx_msg void OnKeyDown(UINT nChar, UINT nRepCnt, UINT nFlags);
     afx_msg BOOL OnHeaderEndDrag(UINT, NMHDR* pNMHDR, LRESULT* pResult);
+    afx_msg LRESULT OnOwnersResolved(WPARAM, LPARAM);
+    afx_msg LRESULT OnImagesResolved(WPARAM, LPARAM);
 };
 
 //
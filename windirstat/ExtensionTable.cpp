@@ -0,0 +1,70 @@
+// ExtensionTable.cpp - Implementation of ExtensionTable
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "stdafx.h"
+#include "ExtensionTable.h"
+#include "GlobalHelpers.h"
+#include "InternTable.h"
+
+#include <string>
+#include <variant>
+
+namespace
+{
+    InternTable<std::wstring, std::monostate, 1 << 16> _extensions(0);
+
+    // Lower cases the extension into a per thread buffer and hashes it (FNV-1a)
+    const std::wstring& Normalize(LPCWSTR ext, size_t& hash)
+    {
+        thread_local std::wstring lower;
+        lower.assign(ext);
+        _wcslwr_s(lower.data(), lower.size() + 1);
+
+        hash = HashFnv1a(lower.data(), lower.size() * sizeof(WCHAR));
+        return lower;
+    }
+}
+
+ULONG ExtensionTable::Intern(const LPCWSTR ext)
+{
+    size_t hash;
+    const std::wstring& name = Normalize(ext, hash);
+    return _extensions.Intern(name, hash);
+}
+
+bool ExtensionTable::Find(const LPCWSTR ext, ULONG& id)
+{
+    size_t hash;
+    const std::wstring& name = Normalize(ext, hash);
+    const auto e = _extensions.Find(name, hash);
+    if (e == nullptr) return false;
+    id = e->id;
+    return true;
+}
+
+LPCWSTR ExtensionTable::GetName(const ULONG id)
+{
+    return _extensions.Get(id).key.c_str();
+}
+
+ULONG ExtensionTable::GetCount()
+{
+    return _extensions.GetCount();
+}
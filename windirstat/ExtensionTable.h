@@ -0,0 +1,37 @@
+// ExtensionTable.h - Declaration of ExtensionTable
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+//
+// ExtensionTable. Interns file extensions (lower case, including the dot) and
+// hands out a small integer id for each of them. Entries are never modified or
+// removed once published, so looking up an extension which is already known
+// does not take any lock; only the first occurrence of a new extension does.
+// Ids are dense and start at zero, so they can be used to index arrays.
+//
+class ExtensionTable final
+{
+public:
+    static ULONG Intern(LPCWSTR ext);
+    static bool Find(LPCWSTR ext, ULONG& id);
+    static LPCWSTR GetName(ULONG id);
+    static ULONG GetCount();
+};
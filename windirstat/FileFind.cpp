@@ -24,8 +24,11 @@
 
 #include "FileFind.h"
 #include "Options.h"
+#include "OwnerTable.h"
 #include <common/Tracer.h>
 
+#include <string>
+
 #pragma comment(lib,"ntdll.lib")
 
 static HMODULE rtl_library = LoadLibrary(L"ntdll.dll");
@@ -35,90 +38,215 @@ static NTSTATUS(WINAPI* NtQueryDirectoryFile)(HANDLE FileHandle, HANDLE Event, P
     ULONG Length, FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
     PUNICODE_STRING FileName, BOOLEAN RestartScan) = reinterpret_cast<decltype(NtQueryDirectoryFile)>(GetProcAddress(rtl_library, "NtQueryDirectoryFile"));
 
-FileFindEnhanced::FileFindEnhanced() = default;
+namespace
+{
+    //
+    // FileFindNt. Native backend which reads whole batches of directory
+    // entries through NtQueryDirectoryFile into a per thread buffer.
+    //
+    class FileFindNt final : public FileFindBackend
+    {
+        typedef struct FILE_DIRECTORY_INFORMATION {
+            ULONG         NextEntryOffset;
+            ULONG         FileIndex;
+            LARGE_INTEGER CreationTime;
+            LARGE_INTEGER LastAccessTime;
+            LARGE_INTEGER LastWriteTime;
+            LARGE_INTEGER ChangeTime;
+            LARGE_INTEGER EndOfFile;
+            LARGE_INTEGER AllocationSize;
+            ULONG         FileAttributes;
+            ULONG         FileNameLength;
+            WCHAR         FileName[1];
+        } FILE_DIRECTORY_INFORMATION, * PFILE_DIRECTORY_INFORMATION;
+
+        std::wstring m_path;
+        std::wstring m_search;
+        HANDLE m_handle = nullptr;
+        bool m_firstrun = true;
+        FILE_DIRECTORY_INFORMATION* m_current_info = nullptr;
+
+    public:
+
+        ~FileFindNt() override
+        {
+            if (m_handle != nullptr) NtClose(m_handle);
+        }
+
+        bool Open(const std::wstring_view folder, const std::wstring_view pattern) override
+        {
+            // stash the search pattern for later user
+            m_search = pattern;
+            m_path = folder;
+
+            UNICODE_STRING u_path = {};
+            u_path.Length = static_cast<USHORT>(m_path.size() * sizeof(WCHAR));
+            u_path.MaximumLength = static_cast<USHORT>(m_path.size() + 1) * sizeof(WCHAR);
+            u_path.Buffer = m_path.data();
+
+            // update object attributes object
+            OBJECT_ATTRIBUTES attributes;
+            InitializeObjectAttributes(&attributes, nullptr, OBJ_CASE_INSENSITIVE, nullptr, nullptr);
+            attributes.ObjectName = &u_path;
+
+            // get an open file handle
+            IO_STATUS_BLOCK status_block = {};
+            if (const NTSTATUS status = NtOpenFile(&m_handle, FILE_LIST_DIRECTORY | SYNCHRONIZE,
+                &attributes, &status_block, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT | FILE_OPEN_FOR_BACKUP_INTENT); status != 0)
+            {
+                VTRACE(L"File Access Error (%08X): %s", status, m_path.c_str());
+                m_handle = nullptr;
+                return false;
+            }
+
+            return true;
+        }
+
+        bool Next(FileFindEntry& entry) override
+        {
+            BOOL success = FALSE;
+            if (m_firstrun || m_current_info->NextEntryOffset == 0)
+            {
+                constexpr auto BUFFER_SIZE = 64 * 1024;
+                thread_local BYTE m_directory_info[BUFFER_SIZE];
+
+                // handle optional pattern mask
+                UNICODE_STRING u_search = {};
+                u_search.Length = static_cast<USHORT>(m_search.size() * sizeof(WCHAR));
+                u_search.MaximumLength = static_cast<USHORT>(m_search.size() + 1) * sizeof(WCHAR);
+                u_search.Buffer = m_search.data();
+
+                // enumerate files in the directory
+                constexpr auto FileDirectoryInformation = 1;
+                IO_STATUS_BLOCK IoStatusBlock;
+                const NTSTATUS Status = NtQueryDirectoryFile(m_handle, nullptr, nullptr, nullptr, &IoStatusBlock,
+                    m_directory_info, BUFFER_SIZE, static_cast<FILE_INFORMATION_CLASS>(FileDirectoryInformation),
+                    FALSE, (u_search.Length > 0) ? &u_search : nullptr, (m_firstrun) ? TRUE : FALSE);
+
+                // disable for next run
+                m_current_info = reinterpret_cast<FILE_DIRECTORY_INFORMATION*>(m_directory_info);
+                m_firstrun     = false;
+                success        = (Status == 0);
+            }
+            else
+            {
+                m_current_info = reinterpret_cast<FILE_DIRECTORY_INFORMATION*>(&((BYTE*)(m_current_info))[m_current_info->NextEntryOffset]);
+                success        = true;
+            }
+
+            if (success)
+            {
+                entry.name = { m_current_info->FileName, m_current_info->FileNameLength / sizeof(WCHAR) };
+                entry.attributes = m_current_info->FileAttributes;
+                entry.endOfFile = m_current_info->EndOfFile.QuadPart;
+                entry.allocationSize = m_current_info->AllocationSize.QuadPart;
+                entry.lastWriteTime = m_current_info->LastWriteTime.QuadPart;
+                entry.hasDetails = true;
+            }
+
+            return success;
+        }
+
+        void LoadDetails(FileFindEntry&) override
+        {
+            // Everything is returned by NtQueryDirectoryFile already
+        }
+
+        // No directory information class carries the owner, so the entry is
+        // opened relative to the directory handle which spares the path
+        // lookup that GetNamedSecurityInfo() does on the full path
+        bool LoadOwner(const FileFindEntry& entry, std::vector<std::uint8_t>& sid) override
+        {
+            UNICODE_STRING u_name = {};
+            u_name.Length = static_cast<USHORT>(entry.name.size() * sizeof(WCHAR));
+            u_name.MaximumLength = u_name.Length;
+            u_name.Buffer = const_cast<PWSTR>(entry.name.data());
+
+            OBJECT_ATTRIBUTES attributes;
+            InitializeObjectAttributes(&attributes, &u_name, OBJ_CASE_INSENSITIVE, m_handle, nullptr);
+
+            HANDLE handle = nullptr;
+            IO_STATUS_BLOCK status_block = {};
+            if (NtOpenFile(&handle, READ_CONTROL, &attributes, &status_block,
+                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                FILE_OPEN_FOR_BACKUP_INTENT | FILE_OPEN_REPARSE_POINT) != 0)
+            {
+                return false;
+            }
+
+            thread_local std::vector<BYTE> descriptor(256);
+            DWORD needed = 0;
+            BOOL success = GetKernelObjectSecurity(handle, OWNER_SECURITY_INFORMATION,
+                descriptor.data(), static_cast<DWORD>(descriptor.size()), &needed);
+            if (!success && GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+            {
+                descriptor.resize(needed);
+                success = GetKernelObjectSecurity(handle, OWNER_SECURITY_INFORMATION,
+                    descriptor.data(), static_cast<DWORD>(descriptor.size()), &needed);
+            }
+            NtClose(handle);
+
+            PSID owner = nullptr;
+            BOOL defaulted = FALSE;
+            if (!success || !GetSecurityDescriptorOwner(descriptor.data(), &owner, &defaulted) || owner == nullptr)
+            {
+                return false;
+            }
+
+            const auto bytes = static_cast<const BYTE*>(owner);
+            sid.assign(bytes, bytes + GetLengthSid(owner));
+            return true;
+        }
+    };
+}
 
-FileFindEnhanced::~FileFindEnhanced()
+std::unique_ptr<FileFindBackend> FileFindBackend::Create()
 {
-    if (m_handle != nullptr) NtClose(m_handle);
+    return std::make_unique<FileFindNt>();
 }
 
+FileFindEnhanced::FileFindEnhanced(const bool owners) : m_backend(FileFindBackend::Create()), m_owners(owners) {}
+
+FileFindEnhanced::~FileFindEnhanced() = default;
+
 bool FileFindEnhanced::FindNextFile()
 {
-    BOOL success = FALSE;
-    if (m_firstrun || m_current_info->NextEntryOffset == 0)
+    if (!m_backend->Next(m_entry))
     {
-        constexpr auto BUFFER_SIZE = 64 * 1024;
-        thread_local BYTE m_directory_info[BUFFER_SIZE];
-
-        // handle optional pattern mask
-        UNICODE_STRING u_search = {};
-        u_search.Length = static_cast<USHORT>(m_search.GetLength() * sizeof(WCHAR));
-        u_search.MaximumLength = static_cast<USHORT>(m_search.GetLength() + 1) * sizeof(WCHAR);
-        u_search.Buffer = m_search.GetBuffer();
-
-        // enumerate files in the directory
-        constexpr auto FileDirectoryInformation = 1;
-        IO_STATUS_BLOCK IoStatusBlock;
-        const NTSTATUS Status = NtQueryDirectoryFile(m_handle, nullptr, nullptr, nullptr, &IoStatusBlock,
-            m_directory_info, BUFFER_SIZE, static_cast<FILE_INFORMATION_CLASS>(FileDirectoryInformation),
-            FALSE, (u_search.Length > 0) ? &u_search : nullptr, (m_firstrun) ? TRUE : FALSE);
-
-        // disable for next run
-        m_current_info = reinterpret_cast<FILE_DIRECTORY_INFORMATION*>(m_directory_info);
-        m_firstrun     = false;
-        success        = (Status == 0);
-    }
-    else
-    {
-        m_current_info = reinterpret_cast<FILE_DIRECTORY_INFORMATION*>(&((BYTE*)(m_current_info))[m_current_info->NextEntryOffset]);
-        success        = true;
-    }
-
-    if (success)
-    {
-        const LPWSTR tmp = m_name.GetBufferSetLength(m_current_info->FileNameLength / sizeof(WCHAR));
-        memcpy(tmp, m_current_info->FileName, m_current_info->FileNameLength);
+        return false;
     }
 
-    return success;
+    m_name.SetString(m_entry.name.data(), static_cast<int>(m_entry.name.size()));
+    return true;
 }
 
 bool FileFindEnhanced::FindFile(const CStringW & strFolder, const CStringW& strName)
 {
-    // stash the search pattern for later user
-    m_search = strName;
-
     // convert the path to a long path that is compatible with the other call
     m_base = strFolder;
     if (m_base.Find(L":\\", 1) == 1) m_base = L"\\??\\" + m_base;
     else if (m_base.Find(L"\\\\") == 0) m_base = L"\\??\\UNC\\" + m_base.Mid(2);
-    UNICODE_STRING u_path = {};
-    u_path.Length = static_cast<USHORT>(m_base.GetLength() * sizeof(WCHAR));
-    u_path.MaximumLength = static_cast<USHORT>(m_base.GetLength() + 1) * sizeof(WCHAR);
-    u_path.Buffer = m_base.GetBuffer();
-
-    // update object attributes object
-    OBJECT_ATTRIBUTES attributes;
-    InitializeObjectAttributes(&attributes, nullptr, OBJ_CASE_INSENSITIVE, nullptr, nullptr);
-    attributes.ObjectName = &u_path;
-
-    // get an open file handle
-    IO_STATUS_BLOCK status_block = {};
-    if (const NTSTATUS status = NtOpenFile(&m_handle, FILE_LIST_DIRECTORY | SYNCHRONIZE,
-        &attributes, &status_block, FILE_SHARE_READ | FILE_SHARE_WRITE, 
-        FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT | FILE_OPEN_FOR_BACKUP_INTENT); status != 0)
+
+    if (!m_backend->Open({ m_base.GetString(), static_cast<size_t>(m_base.GetLength()) },
+        { strName.GetString(), static_cast<size_t>(strName.GetLength()) }))
     {
-        VTRACE(L"File Access Error (%08X): %s", status, m_base.GetBuffer());
-        return FALSE;
+        return false;
     }
 
     // do initial search
     return FindNextFile();
 }
 
+const FileFindEntry& FileFindEnhanced::GetDetails() const
+{
+    if (!m_entry.hasDetails) m_backend->LoadDetails(m_entry);
+    return m_entry;
+}
+
 bool FileFindEnhanced::IsDirectory() const
 {
-    return (m_current_info->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    return (m_entry.attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
 }
 
 bool FileFindEnhanced::IsDots() const
@@ -128,24 +256,24 @@ bool FileFindEnhanced::IsDots() const
 
 bool FileFindEnhanced::IsHidden() const
 {
-    return (m_current_info->FileAttributes & FILE_ATTRIBUTE_HIDDEN) != 0;
+    return (m_entry.attributes & FILE_ATTRIBUTE_HIDDEN) != 0;
 }
 
 bool FileFindEnhanced::IsHiddenSystem() const
 {
     constexpr DWORD hidden_system = FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM;
-    return (m_current_info->FileAttributes & hidden_system) == hidden_system;
+    return (m_entry.attributes & hidden_system) == hidden_system;
 }
 
 bool FileFindEnhanced::IsProtectedReparsePoint() const
 {
     constexpr DWORD protect = FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_REPARSE_POINT;
-    return (m_current_info->FileAttributes & protect) == protect;
+    return (m_entry.attributes & protect) == protect;
 }
 
 DWORD FileFindEnhanced::GetAttributes() const
 {
-    return m_current_info->FileAttributes;
+    return m_entry.attributes;
 }
 
 CStringW FileFindEnhanced::GetFileName() const
@@ -155,19 +283,36 @@ CStringW FileFindEnhanced::GetFileName() const
 
 ULONGLONG FileFindEnhanced::GetFileSize() const
 {
+    const FileFindEntry& entry = GetDetails();
+
     // Optionally retrieve the compressed file size
-    if (m_current_info->FileAttributes & (FILE_ATTRIBUTE_COMPRESSED | FILE_ATTRIBUTE_SPARSE_FILE) && COptions::ShowUncompressedFileSizes)
+    if (entry.attributes & (FILE_ATTRIBUTE_COMPRESSED | FILE_ATTRIBUTE_SPARSE_FILE) && COptions::ShowUncompressedFileSizes)
     {
-        return m_current_info->EndOfFile.QuadPart;
+        return entry.endOfFile;
     }
 
-    return m_current_info->AllocationSize.QuadPart;
+    return entry.allocationSize;
 }
 
 FILETIME FileFindEnhanced::GetLastWriteTime() const
 {
-    return { m_current_info->LastWriteTime.LowPart,
-        static_cast<DWORD>(m_current_info->LastWriteTime.HighPart) };
+    const FileFindEntry& entry = GetDetails();
+    return { static_cast<DWORD>(entry.lastWriteTime),
+        static_cast<DWORD>(entry.lastWriteTime >> 32) };
+}
+
+// Returns the id of the owner in the OwnerTable if the finder was created
+// to read owners, otherwise OwnerTable::Pending.
+//
+ULONG FileFindEnhanced::GetOwnerId() const
+{
+    if (!m_owners)
+    {
+        return OwnerTable::Pending;
+    }
+
+    thread_local std::vector<std::uint8_t> sid;
+    return m_backend->LoadOwner(m_entry, sid) ? OwnerTable::Intern(sid.data()) : OwnerTable::None;
 }
 
 CStringW FileFindEnhanced::GetFilePath() const
@@ -22,35 +22,23 @@
 #pragma once
 
 #include <stdafx.h>
+#include "FileFindBackend.h"
 
 class FileFindEnhanced final
 {
 private:
 
-    typedef struct FILE_DIRECTORY_INFORMATION {
-        ULONG         NextEntryOffset;
-        ULONG         FileIndex;
-        LARGE_INTEGER CreationTime;
-        LARGE_INTEGER LastAccessTime;
-        LARGE_INTEGER LastWriteTime;
-        LARGE_INTEGER ChangeTime;
-        LARGE_INTEGER EndOfFile;
-        LARGE_INTEGER AllocationSize;
-        ULONG         FileAttributes;
-        ULONG         FileNameLength;
-        WCHAR         FileName[1];
-    } FILE_DIRECTORY_INFORMATION, * PFILE_DIRECTORY_INFORMATION;
-
-    CStringW m_search;
+    std::unique_ptr<FileFindBackend> m_backend;
+    mutable FileFindEntry m_entry;
     CStringW m_base;
     CStringW m_name;
-    HANDLE m_handle = nullptr;
-    bool m_firstrun = true;
-    FILE_DIRECTORY_INFORMATION* m_current_info = nullptr;
+    bool m_owners;
+
+    const FileFindEntry& GetDetails() const;
 
 public:
 
-    FileFindEnhanced();
+    explicit FileFindEnhanced(bool owners = false);
     ~FileFindEnhanced();
 
     bool FindNextFile();
@@ -64,6 +52,7 @@ public:
     CStringW GetFileName() const;
     ULONGLONG GetFileSize() const;
     FILETIME GetLastWriteTime() const;
+    ULONG GetOwnerId() const;
     CStringW GetFilePath() const;
     static bool DoesFileExist(const CStringW& folder, const CStringW& file);
     static CStringW GetLongPathCompatible(const CStringW& path);
@@ -0,0 +1,72 @@
+// FileFindBackend.h - Declaration of FileFindBackend
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+// This header is shared with the non-Windows enumeration backends
+// and therefore must not depend on MFC or the Windows headers.
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+//
+// FileFindEntry. One directory entry as reported by a FileFindBackend.
+// The attributes use the values of the Windows FILE_ATTRIBUTE_* flags and the
+// time is in FILETIME units (100ns intervals since January 1, 1601 UTC).
+// Backends which have to issue a separate call for the size and time
+// information leave hasDetails unset until LoadDetails() is called.
+//
+struct FileFindEntry
+{
+    std::wstring_view name;
+    std::uint32_t attributes = 0;
+    std::uint64_t endOfFile = 0;
+    std::uint64_t allocationSize = 0;
+    std::uint64_t lastWriteTime = 0;
+    bool hasDetails = false;
+};
+
+//
+// FileFindBackend. Enumerates the entries of a single directory in bulk.
+// FileFindEnhanced uses the native backend of the platform it runs on.
+//
+class FileFindBackend
+{
+public:
+    FileFindBackend() = default;
+    FileFindBackend(const FileFindBackend&) = delete;
+    FileFindBackend& operator=(const FileFindBackend&) = delete;
+    virtual ~FileFindBackend() = default;
+
+    // Opens the directory; the optional pattern restricts the entries returned
+    virtual bool Open(std::wstring_view folder, std::wstring_view pattern) = 0;
+
+    // Advances to the next entry; the entry stays valid until the next call
+    virtual bool Next(FileFindEntry& entry) = 0;
+
+    // Fills in the size and time of the current entry if still missing
+    virtual void LoadDetails(FileFindEntry& entry) = 0;
+
+    // Reads the binary owner sid of the current entry; false if there is none
+    virtual bool LoadOwner(const FileFindEntry& entry, std::vector<std::uint8_t>& sid) = 0;
+
+    static std::unique_ptr<FileFindBackend> Create();
+};
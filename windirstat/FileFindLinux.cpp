@@ -0,0 +1,235 @@
+// FileFindLinux.cpp - Implementation of the Linux FileFindBackend
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+// This backend is not part of the Windows project (see premake4.lua); it is
+// compiled against FileFindBackend.h only, e.g. by sandbox/filefind.
+#ifdef __linux__
+
+#include "FileFindBackend.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace
+{
+    // Windows attribute values as reported through FileFindEntry
+    constexpr std::uint32_t ATTRIBUTE_HIDDEN        = 0x00000002;
+    constexpr std::uint32_t ATTRIBUTE_DIRECTORY     = 0x00000010;
+    constexpr std::uint32_t ATTRIBUTE_NORMAL        = 0x00000080;
+    constexpr std::uint32_t ATTRIBUTE_REPARSE_POINT = 0x00000400;
+
+    // Identifier authority of the S-1-22-1-<uid> sids which Samba and the
+    // Windows NFS client use for Unix users
+    constexpr std::uint8_t UNIX_USER_AUTHORITY = 22;
+
+    // Seconds between the FILETIME epoch (1601) and the Unix epoch (1970)
+    constexpr std::uint64_t EPOCH_DIFFERENCE = 11644473600ull;
+
+    constexpr size_t BUFFER_SIZE = 256 * 1024;
+
+    struct linux_dirent64
+    {
+        ino64_t        d_ino;
+        off64_t        d_off;
+        unsigned short d_reclen;
+        unsigned char  d_type;
+        char           d_name[1];
+    };
+
+    std::string ToUtf8(const std::wstring_view s)
+    {
+        std::string result;
+        result.reserve(s.size());
+        for (const wchar_t wc : s)
+        {
+            const auto c = static_cast<std::uint32_t>(wc);
+            if (c < 0x80)
+            {
+                result += static_cast<char>(c);
+            }
+            else if (c < 0x800)
+            {
+                result += static_cast<char>(0xC0 | (c >> 6));
+                result += static_cast<char>(0x80 | (c & 0x3F));
+            }
+            else if (c < 0x10000)
+            {
+                result += static_cast<char>(0xE0 | (c >> 12));
+                result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+                result += static_cast<char>(0x80 | (c & 0x3F));
+            }
+            else
+            {
+                result += static_cast<char>(0xF0 | (c >> 18));
+                result += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+                result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+                result += static_cast<char>(0x80 | (c & 0x3F));
+            }
+        }
+        return result;
+    }
+
+    // Decodes a UTF-8 name; invalid sequences become U+FFFD
+    void FromUtf8(const char* s, std::wstring& result)
+    {
+        result.clear();
+        for (auto p = reinterpret_cast<const unsigned char*>(s); *p != 0;)
+        {
+            const unsigned char lead = *p++;
+            int extra = lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : 0;
+            std::uint32_t c = extra == 3 ? lead & 0x07 : extra == 2 ? lead & 0x0F : extra == 1 ? lead & 0x1F : lead;
+            if (lead >= 0x80 && extra == 0) c = 0xFFFD;
+            for (; extra > 0; extra--, p++)
+            {
+                if ((*p & 0xC0) != 0x80)
+                {
+                    c = 0xFFFD;
+                    break;
+                }
+                c = (c << 6) | (*p & 0x3F);
+            }
+            result += static_cast<wchar_t>(c);
+        }
+    }
+
+    //
+    // FileFindLinux. Reads the raw directory records with getdents64 into a
+    // large per thread buffer. The entry type comes with the record; size and
+    // time need a statx call which is only issued when they are asked for.
+    //
+    class FileFindLinux final : public FileFindBackend
+    {
+        int m_fd = -1;
+        std::string m_pattern;
+        std::wstring m_name;
+        const char* m_rawName = nullptr;
+        size_t m_offset = 0;
+        size_t m_filled = 0;
+        bool m_eof = false;
+
+    public:
+
+        ~FileFindLinux() override
+        {
+            if (m_fd >= 0) close(m_fd);
+        }
+
+        bool Open(const std::wstring_view folder, const std::wstring_view pattern) override
+        {
+            m_pattern = ToUtf8(pattern);
+            m_fd = openat(AT_FDCWD, ToUtf8(folder).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            return m_fd >= 0;
+        }
+
+        bool Next(FileFindEntry& entry) override
+        {
+            thread_local char buffer[BUFFER_SIZE];
+
+            for (;;)
+            {
+                if (m_offset >= m_filled)
+                {
+                    if (m_eof) return false;
+                    const long read = syscall(SYS_getdents64, m_fd, buffer, BUFFER_SIZE);
+                    if (read <= 0)
+                    {
+                        m_eof = true;
+                        return false;
+                    }
+                    m_filled = static_cast<size_t>(read);
+                    m_offset = 0;
+                }
+
+                const auto record = reinterpret_cast<const linux_dirent64*>(&buffer[m_offset]);
+                m_offset += record->d_reclen;
+                if (!m_pattern.empty() && fnmatch(m_pattern.c_str(), record->d_name, FNM_NOESCAPE) != 0)
+                {
+                    continue;
+                }
+
+                m_rawName = record->d_name;
+                FromUtf8(m_rawName, m_name);
+
+                entry = {};
+                entry.name = m_name;
+                if (m_rawName[0] == '.') entry.attributes |= ATTRIBUTE_HIDDEN;
+                switch (record->d_type)
+                {
+                case DT_DIR: entry.attributes |= ATTRIBUTE_DIRECTORY; break;
+                case DT_LNK: entry.attributes |= ATTRIBUTE_REPARSE_POINT; break;
+                case DT_UNKNOWN: LoadDetails(entry); break;
+                default: break;
+                }
+                if (entry.attributes == 0) entry.attributes = ATTRIBUTE_NORMAL;
+                return true;
+            }
+        }
+
+        void LoadDetails(FileFindEntry& entry) override
+        {
+            entry.hasDetails = true;
+
+            struct statx stx;
+            if (statx(m_fd, m_rawName, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                STATX_TYPE | STATX_SIZE | STATX_BLOCKS | STATX_MTIME, &stx) != 0)
+            {
+                return;
+            }
+
+            if (S_ISDIR(stx.stx_mode)) entry.attributes |= ATTRIBUTE_DIRECTORY;
+            else if (S_ISLNK(stx.stx_mode)) entry.attributes |= ATTRIBUTE_REPARSE_POINT;
+            entry.endOfFile = stx.stx_size;
+            entry.allocationSize = stx.stx_blocks * 512;
+            entry.lastWriteTime = (static_cast<std::uint64_t>(stx.stx_mtime.tv_sec) + EPOCH_DIFFERENCE) * 10000000ull +
+                stx.stx_mtime.tv_nsec / 100;
+        }
+
+        bool LoadOwner(const FileFindEntry&, std::vector<std::uint8_t>& sid) override
+        {
+            struct statx stx;
+            if (statx(m_fd, m_rawName, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, STATX_UID, &stx) != 0)
+            {
+                return false;
+            }
+
+            // Revision, two sub authorities, the authority (big endian)
+            // and the sub authorities 1 and uid (little endian)
+            sid.assign({ 1, 2, 0, 0, 0, 0, 0, UNIX_USER_AUTHORITY, 1, 0, 0, 0 });
+            for (int shift = 0; shift < 32; shift += 8)
+            {
+                sid.push_back(static_cast<std::uint8_t>(stx.stx_uid >> shift));
+            }
+            return true;
+        }
+    };
+}
+
+std::unique_ptr<FileFindBackend> FileFindBackend::Create()
+{
+    return std::make_unique<FileFindLinux>();
+}
+
+#endif // __linux__
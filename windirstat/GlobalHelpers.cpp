@@ -30,6 +30,7 @@
 #include "Localization.h"
 
 #include <algorithm>
+#include <cstdint>
 
 namespace
 {
@@ -709,3 +710,17 @@ bool EnableReadPrivileges()
 
     return ret;
 }
+
+// 64-bit FNV-1a over the bytes, folded to 32 bits on 32-bit builds
+size_t HashFnv1a(const void* data, const size_t length)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    const auto bytes = static_cast<const BYTE*>(data);
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    if constexpr (sizeof(size_t) < sizeof(hash)) hash ^= hash >> 32;
+    return static_cast<size_t>(hash);
+}
@@ -56,3 +56,4 @@ CStringW GetSpec_GB();
 CStringW GetSpec_TB();
 BOOL IsAdmin();
 bool EnableReadPrivileges();
+size_t HashFnv1a(const void* data, size_t length);
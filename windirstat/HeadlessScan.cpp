@@ -0,0 +1,258 @@
+// HeadlessScan.cpp - Implementation of the command line scanner
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "stdafx.h"
+#include "WinDirStat.h"
+#include "DirStatDoc.h"
+#include "Item.h"
+#include "CsvLoader.h"
+#include "SnapshotLoader.h"
+#include "Options.h"
+#include "GlobalHelpers.h"
+#include "BlockingQueue.h"
+#include "BlockingQueueBenchmark.h"
+#include "HeadlessScan.h"
+
+#include <chrono>
+#include <format>
+#include <stack>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Size of a FILE_DIRECTORY_INFORMATION record without the name
+    constexpr ULONGLONG DIRECTORY_RECORD_SIZE = 64;
+
+    // Thread counts /queuebench goes up to without /threads
+    constexpr int QUEUE_BENCH_MAX_THREADS = 64;
+
+    struct HeadlessOptions
+    {
+        CStringW folder;
+        CStringW load;
+        CStringW save;
+        int threads = 0;
+        bool owners = false;
+        bool queueBench = false;
+    };
+
+    bool ParseArguments(HeadlessOptions& options)
+    {
+        bool requested = false;
+        for (int i = 1; i < __argc; i++)
+        {
+            const bool hasValue = i + 1 < __argc;
+            if (_wcsicmp(__wargv[i], L"/scan") == 0 && hasValue)
+            {
+                options.folder = __wargv[++i];
+                requested = true;
+            }
+            else if (_wcsicmp(__wargv[i], L"/load") == 0 && hasValue)
+            {
+                options.load = __wargv[++i];
+                requested = true;
+            }
+            else if (_wcsicmp(__wargv[i], L"/save") == 0 && hasValue)
+            {
+                options.save = __wargv[++i];
+            }
+            else if (_wcsicmp(__wargv[i], L"/threads") == 0 && hasValue)
+            {
+                options.threads = _wtoi(__wargv[++i]);
+            }
+            else if (_wcsicmp(__wargv[i], L"/owners") == 0)
+            {
+                options.owners = true;
+            }
+            else if (_wcsicmp(__wargv[i], L"/queuebench") == 0)
+            {
+                options.queueBench = true;
+                requested = true;
+            }
+        }
+        return requested;
+    }
+
+    // Writes to redirected output or else to the console we were started from
+    void Print(const std::wstring& text)
+    {
+        static HANDLE out = []
+        {
+            HANDLE handle = GetStdHandle(STD_OUTPUT_HANDLE);
+            if ((handle == nullptr || handle == INVALID_HANDLE_VALUE) && AttachConsole(ATTACH_PARENT_PROCESS))
+            {
+                handle = CreateFile(L"CONOUT$", GENERIC_WRITE, FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+            }
+            return handle;
+        }();
+        if (out == nullptr || out == INVALID_HANDLE_VALUE) return;
+
+        const CStringA utf8 = CW2A(text.c_str(), CP_UTF8);
+        DWORD written;
+        WriteFile(out, utf8.GetString(), utf8.GetLength(), &written, nullptr);
+    }
+
+    ULONGLONG GetThreadBusyTime(std::thread& thread)
+    {
+        FILETIME creation, exit, kernel, user;
+        if (!GetThreadTimes(thread.native_handle(), &creation, &exit, &kernel, &user)) return 0;
+        return (static_cast<ULONGLONG>(kernel.dwHighDateTime) << 32 | kernel.dwLowDateTime) +
+            (static_cast<ULONGLONG>(user.dwHighDateTime) << 32 | user.dwLowDateTime);
+    }
+
+    ULONGLONG GetDirectoryRecordBytes(const CItem* root)
+    {
+        ULONGLONG bytes = 0;
+        std::stack<const CItem*> queue;
+        queue.push(root);
+        while (!queue.empty())
+        {
+            const CItem* item = queue.top();
+            queue.pop();
+            bytes += DIRECTORY_RECORD_SIZE + item->GetName().GetLength() * sizeof(WCHAR);
+            if (item->IsType(IT_FILE)) continue;
+            for (const auto& child : item->GetChildren())
+            {
+                queue.push(child);
+            }
+        }
+        return bytes;
+    }
+
+    double SecondsSince(const std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    CItem* ScanFolder(const HeadlessOptions& options)
+    {
+        const int threads = options.threads > 0 ? options.threads : static_cast<int>(COptions::ScanningThreads);
+
+        if (COptions::UseBackupRestore && !EnableReadPrivileges())
+        {
+            Print(L"Warning: unable to enable backup privileges.\r\n");
+        }
+        GetWDSApp()->ReReadMountPoints();
+
+        // Same root setup as CDirStatDoc::OnOpenDocument() for a single folder
+        const ITEMTYPE type = CDirStatDoc::IsDrive(options.folder) ? IT_DRIVE : IT_DIRECTORY;
+        const auto root = new CItem(type | ITF_ROOTITEM, options.folder);
+        root->UpdateStatsFromDisk();
+
+        const auto start = std::chrono::steady_clock::now();
+        BlockingQueue<CItem*> queue(threads);
+        root->UpwardAddReadJobs(1);
+        queue.push(root);
+
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; i++)
+        {
+            workers.emplace_back([&queue, &options]
+            {
+                CItem::ScanItems(&queue, options.owners);
+            });
+        }
+
+        // Wait for the workers to run out of work and collect their cpu times
+        queue.wait_for_all();
+        queue.drain(nullptr);
+        const double seconds = SecondsSince(start);
+        std::vector<ULONGLONG> busy;
+        for (auto& worker : workers)
+        {
+            busy.push_back(GetThreadBusyTime(worker));
+            worker.join();
+        }
+        CItem::ScanItemsFinalize(root);
+
+        const ULONGLONG items = root->GetItemsCount();
+        const ULONGLONG recordBytes = GetDirectoryRecordBytes(root);
+        Print(std::format(L"Scanned: {}\r\n", options.folder.GetString()));
+        Print(std::format(L"Items: {} ({} files, {} folders), {} bytes\r\n",
+            items, root->GetFilesCount(), root->GetSubdirsCount(), root->GetSize()));
+        Print(std::format(L"Elapsed: {:.3f} s with {} threads{}\r\n", seconds, threads,
+            options.owners ? L", reading owners" : L""));
+        Print(std::format(L"Throughput: {:.0f} items/s, {:.0f} bytes of metadata/s\r\n",
+            items / seconds, recordBytes / seconds));
+        for (size_t i = 0; i < busy.size(); i++)
+        {
+            Print(std::format(L"Thread {}: {:.1f}% busy\r\n", i, busy[i] / 1e7 / seconds * 100.0));
+        }
+        return root;
+    }
+
+    CItem* LoadFromFile(const HeadlessOptions& options)
+    {
+        const std::wstring path = options.load.GetString();
+        const auto start = std::chrono::steady_clock::now();
+        CItem* root = IsSnapshotFile(path) ? LoadSnapshot(path) : LoadResults(path);
+        const double seconds = SecondsSince(start);
+        if (root == nullptr)
+        {
+            Print(std::format(L"Unable to load {}\r\n", path));
+            return nullptr;
+        }
+
+        const ULONGLONG items = root->GetItemsCount();
+        Print(std::format(L"Loaded: {}\r\n", path));
+        Print(std::format(L"Items: {} ({} files, {} folders), {} bytes\r\n",
+            items, root->GetFilesCount(), root->GetSubdirsCount(), root->GetSize()));
+        Print(std::format(L"Elapsed: {:.3f} s, {:.0f} items/s\r\n", seconds, items / seconds));
+        return root;
+    }
+}
+
+bool IsHeadlessScanRequested()
+{
+    HeadlessOptions options;
+    return ParseArguments(options);
+}
+
+int RunHeadlessScan()
+{
+    HeadlessOptions options;
+    ParseArguments(options);
+    if (options.queueBench)
+    {
+        RunQueueBenchmark(options.threads > 0 ? options.threads : QUEUE_BENCH_MAX_THREADS, [](const std::wstring& line)
+        {
+            Print(line + L"\r\n");
+        });
+        return 0;
+    }
+
+    CItem* root = options.load.IsEmpty() ? ScanFolder(options) : LoadFromFile(options);
+    if (root == nullptr) return 1;
+
+    bool success = true;
+    if (!options.save.IsEmpty())
+    {
+        const std::wstring path = options.save.GetString();
+        const auto start = std::chrono::steady_clock::now();
+        success = IsSnapshotFile(path) ? SaveSnapshot(path, root) : SaveResults(path, root);
+        Print(std::format(L"{} {} in {:.3f} s\r\n", success ? L"Saved" : L"Unable to save", path, SecondsSince(start)));
+    }
+
+    delete root;
+    CItem::PurgeAllocations();
+    return success ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+// HeadlessScan.h - Declaration of the command line scanner
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+// Scans a folder with the regular scan engine (or loads earlier results)
+// without creating any windows, optionally saves the results and prints
+// throughput statistics. Files ending in .wdsnap use the snapshot format.
+// With /owners the owner of each item is read during the scan as it is
+// with the owner column shown, which tells the cost of doing so.
+// /queuebench walks a synthetic tree through the scan queue and through a
+// single-lock queue at 1 to 64 threads (or up to /threads) to compare them:
+//
+//     windirstat.exe /scan <folder> [/save <file>] [/threads <n>] [/owners]
+//     windirstat.exe /load <file> [/save <file>]
+//     windirstat.exe /queuebench [/threads <n>]
+//
+bool IsHeadlessScanRequested();
+int RunHeadlessScan();
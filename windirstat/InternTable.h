@@ -0,0 +1,122 @@
+// InternTable.h - Declaration of InternTable
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+//
+// InternTable. Hands out a small integer id for each distinct key and keeps a
+// value along with it. Entries are never modified or removed once published,
+// so looking up a key which is already known does not take any lock; only the
+// first occurrence of a new key does. Ids are dense and start at firstId, so
+// they can be used to index arrays. Keys are looked up by anything that
+// compares element-wise to them, e.g. a std::span for a std::vector; the
+// caller provides the hash.
+//
+template <typename Key, typename Value, size_t BucketCount>
+class InternTable final
+{
+    static constexpr size_t CHUNK_BITS = 12;
+    static constexpr size_t CHUNK_SIZE = 1 << CHUNK_BITS;
+    static constexpr size_t CHUNK_COUNT = 1 << 12;
+
+public:
+    struct Entry
+    {
+        const Entry* next;
+        size_t hash;
+        ULONG id;
+        Key key;
+        Value value;
+    };
+
+    constexpr explicit InternTable(const ULONG firstId) : m_count(firstId) {}
+
+    template <typename Lookup>
+    const Entry* Find(const Lookup& key, const size_t hash) const
+    {
+        for (const Entry* e = m_buckets[hash % BucketCount].load(std::memory_order_acquire); e != nullptr; e = e->next)
+        {
+            if (e->hash == hash && std::ranges::equal(e->key, key)) return e;
+        }
+        return nullptr;
+    }
+
+    // Returns the id of key, which gets the given value if it is new
+    template <typename Lookup>
+    ULONG Insert(const Lookup& key, const size_t hash, Value value)
+    {
+        // Check again under the lock since another
+        // thread may have added it in the meantime
+        std::lock_guard lock(m_insertLock);
+        if (const Entry* e = Find(key, hash); e != nullptr)
+        {
+            return e->id;
+        }
+
+        const ULONG id = m_count.load(std::memory_order_relaxed);
+        ASSERT(id < CHUNK_SIZE * CHUNK_COUNT);
+
+        // Record the entry in the id lookup before it becomes visible in the
+        // bucket so that anyone who obtains the id can also resolve it
+        auto& bucket = m_buckets[hash % BucketCount];
+        const auto entry = new Entry{ bucket.load(std::memory_order_relaxed), hash, id, Key(key.begin(), key.end()), std::move(value) };
+        auto& chunk = m_chunks[id >> CHUNK_BITS];
+        if (chunk.load(std::memory_order_relaxed) == nullptr)
+        {
+            chunk.store(new const Entry*[CHUNK_SIZE], std::memory_order_release);
+        }
+        chunk.load(std::memory_order_relaxed)[id & (CHUNK_SIZE - 1)] = entry;
+        m_count.store(id + 1, std::memory_order_release);
+        bucket.store(entry, std::memory_order_release);
+        return id;
+    }
+
+    // Returns the id of key, adding it with a default value if it is new
+    template <typename Lookup>
+    ULONG Intern(const Lookup& key, const size_t hash)
+    {
+        if (const Entry* e = Find(key, hash); e != nullptr)
+        {
+            return e->id;
+        }
+        return Insert(key, hash, Value());
+    }
+
+    const Entry& Get(const ULONG id) const
+    {
+        ASSERT(id < GetCount());
+        return *m_chunks[id >> CHUNK_BITS].load(std::memory_order_acquire)[id & (CHUNK_SIZE - 1)];
+    }
+
+    ULONG GetCount() const
+    {
+        return m_count.load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<const Entry*> m_buckets[BucketCount] = {};
+    std::atomic<const Entry**> m_chunks[CHUNK_COUNT] = {};
+    std::atomic<ULONG> m_count;
+    std::mutex m_insertLock;
+};
@@ -20,8 +20,6 @@
 //
 
 #include "stdafx.h"
-#include "aclapi.h"
-#include "sddl.h"
 
 #include "WinDirStat.h"
 #include "DirStatDoc.h"
@@ -31,56 +29,87 @@
 #include "SelectObject.h"
 #include "Item.h"
 #include "BlockingQueue.h"
+#include "StringPool.h"
+#include "ExtensionTable.h"
+#include "OwnerTable.h"
 
 #include <string>
 #include <algorithm>
-#include <unordered_set>
+#include <atomic>
 #include <concurrent_queue.h>
 #include <functional>
 #include <queue>
 #include <shared_mutex>
 #include <stack>
+#include <thread>
 
 #include "Localization.h"
 #include "SmartPointer.h"
 
+namespace
+{
+    // Interval at which partial directory totals are pushed to the ancestors
+    constexpr ULONGLONG PUBLISH_INTERVAL_MS = 250;
+
+    // Subtrees with fewer items are collected by a single thread
+    constexpr ULONGLONG COLLECT_SPLIT_ITEMS = 20000;
+
+    void CountExtension(CExtensionTotals& totals, const ULONG ext, const ULONGLONG size)
+    {
+        if (ext >= totals.size()) totals.resize(ext + 1);
+        totals[ext].files++;
+        totals[ext].bytes += size;
+    }
+
+    void CollectExtensions(const CItem* root, CExtensionTotals& totals)
+    {
+        std::stack<const CItem*> queue;
+        queue.push(root);
+        while (!queue.empty())
+        {
+            const CItem* qitem = queue.top();
+            queue.pop();
+            if (qitem->IsType(IT_FILE))
+            {
+                CountExtension(totals, qitem->GetExtensionId(), qitem->GetSize());
+            }
+            else for (const auto& child : qitem->GetChildren())
+            {
+                queue.push(child);
+            }
+        }
+    }
+}
+
 CItem::CItem(ITEMTYPE type, LPCWSTR name)
-    : m_name(name)
-      , m_lastChange{0, 0}
+    : m_lastChange{0, 0}
       , m_ci(nullptr)
       , m_size(0)
       , m_attributes(0)
       , m_type(type)
+      , m_owner(OwnerTable::Pending)
 {
     if (IsType(IT_DRIVE))
     {
-        m_name = FormatVolumeNameOfRootPath(m_name);
+        const CStringW volumeName = FormatVolumeNameOfRootPath(name);
+        m_nameLen = static_cast<USHORT>(volumeName.GetLength());
+        m_name = StringPool::Add(volumeName.GetString(), m_nameLen);
+    }
+    else
+    {
+        m_nameLen = static_cast<USHORT>(wcslen(name));
+        m_name = StringPool::Add(name, m_nameLen);
     }
 
     if (IsType(IT_FILE))
     {
         const LPCWSTR ext = wcsrchr(name, L'.');
-        if (ext == nullptr)
-        {
-            static LPCWSTR noext = L".";
-            m_extension = noext;
-        }
-        else
-        {
-            std::wstring exttoadd(&ext[0]);
-            _wcslwr_s(exttoadd.data(), exttoadd.size() + 1);
-
-            static std::shared_mutex extlock;
-            static std::unordered_set<std::wstring> extcache;
-            std::lock_guard lock(extlock);
-            const auto cached = extcache.insert(std::move(exttoadd));
-            m_extension = cached.first->c_str();
-        }
+        m_extension = ExtensionTable::Intern(ext == nullptr ? L"." : ext);
     }
     else
     {
         m_ci = new CHILDINFO;
-        m_extension = m_name.GetString();
+        m_extension = 0;
     }
 }
 
@@ -99,6 +128,7 @@ CItem::CItem(ITEMTYPE type, LPCWSTR name, FILETIME lastChange,
 
 CItem::~CItem()
 {
+    StringPool::Release(m_nameLen);
     if (m_ci)
     {
         for (const auto& m_child : m_ci->m_children)
@@ -109,6 +139,46 @@ CItem::~CItem()
     }
 }
 
+void* CItem::operator new(const size_t size)
+{
+    ASSERT(size == sizeof(CItem));
+    return SlabAllocator<sizeof(CItem)>::Allocate();
+}
+
+void CItem::operator delete(void* p)
+{
+    SlabAllocator<sizeof(CItem)>::Free(p);
+}
+
+void CItem::PurgeAllocations()
+{
+    SlabAllocator<sizeof(CItem)>::Purge();
+    SlabAllocator<sizeof(CHILDINFO)>::Purge();
+    StringPool::Purge();
+}
+
+void CItem::CompactNames(CItem* root)
+{
+    if (root == nullptr || !StringPool::IsFragmented()) return;
+
+    StringPool::Compact([root]
+    {
+        std::stack<CItem*> queue;
+        queue.push(root);
+        while (!queue.empty())
+        {
+            CItem* item = queue.top();
+            queue.pop();
+            item->m_name = StringPool::Add(item->m_name, item->m_nameLen);
+            if (item->IsType(IT_FILE)) continue;
+            for (const auto& child : item->GetChildren())
+            {
+                queue.push(child);
+            }
+        }
+    });
+}
+
 CRect CItem::TmiGetRectangle() const
 {
     return m_rect;
@@ -300,7 +370,7 @@ int CItem::CompareSibling(const CTreeListItem* tlib, int subitem) const
         }
         else
         {
-            r = signum(m_name.CompareNoCase(other->m_name));
+            r = signum(_wcsicmp(m_name, other->m_name));
         }
         break;
 
@@ -368,7 +438,7 @@ int CItem::CompareSibling(const CTreeListItem* tlib, int subitem) const
 
     case COL_OWNER:
         {
-            r = signum(GetOwner().CompareNoCase(other->GetOwner()));
+            r = OwnerTable::Compare(GetOwnerId(), other->GetOwnerId());
         }
         break;
 
@@ -426,7 +496,12 @@ short CItem::GetImageToCache() const
         return GetMyImageList()->getJunctionImage();
     }
 
-    return GetMyImageList()->getFileImage(path);
+    // Files and folders with icons of their own show a placeholder
+    // until their icon has been looked up in the background
+    short image;
+    m_vi->imagePending = !GetMyImageList()->getItemImage(path,
+        IsType(IT_FILE) ? ExtensionTable::GetName(m_extension) : nullptr, GetTreeListControl()->m_hWnd, image);
+    return image;
 }
 
 void CItem::DrawAdditionalState(CDC* pdc, const CRect& rcLabel) const
@@ -531,6 +606,18 @@ const std::vector<CItem*>& CItem::GetChildren() const
     return m_ci->m_children;
 }
 
+// Copies the children for a reader outside of the scan; returns false
+// instead of waiting if a scan thread is changing them right now.
+//
+bool CItem::TryCopyChildren(std::vector<CItem*>& children) const
+{
+    if (!m_ci) return false;
+    const std::shared_lock lock(m_ci->m_protect, std::try_to_lock);
+    if (!lock.owns_lock()) return false;
+    children = m_ci->m_children;
+    return true;
+}
+
 CItem* CItem::GetParent() const
 {
     return reinterpret_cast<CItem*>(CTreeListItem::GetParent());
@@ -781,23 +868,43 @@ CStringW CItem::GetPath() const
 
 CStringW CItem::GetOwner(bool force) const
 {
-    if (!IsVisible() && !force)
+    return OwnerTable::GetName(GetOwnerId(force));
+}
+
+// Like GetOwner(true) for callers which already know the path of the item
+//
+CStringW CItem::GetOwner(const LPCWSTR path) const
+{
+    return OwnerTable::GetName(m_owner != OwnerTable::Pending ? m_owner : OwnerTable::Query(path));
+}
+
+// Unless it has been read while scanning, the owner is read from disk
+// right away with force, otherwise only visible items have one. It is
+// looked up in the background and shows up empty until the tree list
+// is told it has been found.
+//
+ULONG CItem::GetOwnerId(bool force) const
+{
+    if (m_owner != OwnerTable::Pending)
     {
-        return L"";
+        return m_owner;
     }
 
-    // If visible, use cached variable
-    CStringW tmp;
-    CStringW & ret = (force) ? tmp : m_vi->owner;
-    if (!ret.IsEmpty()) return ret;
+    if (force)
+    {
+        return OwnerTable::Query(GetPath());
+    }
 
-    // Fetch owner information from disk
-    SmartPointer<PSECURITY_DESCRIPTOR> ps(LocalFree);
-    PSID sid = nullptr;
-    GetNamedSecurityInfo(GetPath(), SE_FILE_OBJECT, OWNER_SECURITY_INFORMATION,
-        &sid, nullptr, nullptr, nullptr, &ps);
-    ret = GetNameFromSid(sid).c_str();
-    return ret;
+    if (!IsVisible())
+    {
+        return OwnerTable::None;
+    }
+
+    if (m_vi->owner == OwnerTable::Pending)
+    {
+        OwnerTable::Resolve(GetPath(), GetTreeListControl()->m_hWnd, m_vi->owner);
+    }
+    return m_vi->owner;
 }
 
 bool CItem::HasUncPath() const
@@ -857,11 +964,17 @@ CStringW CItem::GetReportPath() const
 
 CStringW CItem::GetName() const
 {
-    return m_name;
+    return CStringW(m_name, m_nameLen);
 }
 
 CStringW CItem::GetExtension() const
 {
+    return IsType(IT_FILE) ? ExtensionTable::GetName(m_extension) : GetName();
+}
+
+ULONG CItem::GetExtensionId() const
+{
+    ASSERT(IsType(IT_FILE));
     return m_extension;
 }
 
@@ -935,19 +1048,47 @@ void CItem::ScanItemsFinalize(CItem* item)
     }
 }
 
-void CItem::ScanItems(BlockingQueue<CItem*> * queue)
+// With owners set the owner of each item is read as it is found,
+// so it is known for the whole tree and not just the visible rows.
+//
+void CItem::ScanItems(BlockingQueue<CItem*> * queue, const bool owners)
 {
+    // Extension totals of this worker, handed to the document when it exits
+    CExtensionTotals totals;
+
     while (CItem * item = queue->pop())
     {
         // Used to trigger thread exit condition
-        if (item == nullptr) return;
+        if (item == nullptr) break;
 
         // Mark the time we started evaluating this node
         if (item->m_ci) item->m_ci->m_tstart = static_cast<ULONG>(GetTickCount64() / 1000ull);
 
         if (item->IsType(IT_DRIVE | IT_DIRECTORY))
         {
-            FileFindEnhanced finder;
+            // Totals are accumulated locally and only published to the
+            // ancestors periodically and once the directory is complete
+            // so that each file does not cost a walk up to the root
+            ULONG files = 0;
+            ULONG subdirs = 0;
+            ULONGLONG size = 0;
+            FILETIME lastChange = {};
+            ULONGLONG nextPublish = GetTickCount64() + PUBLISH_INTERVAL_MS;
+            const auto publish = [&]
+            {
+                item->UpwardAddFiles(files);
+                item->UpwardAddSubdirs(subdirs);
+                item->UpwardAddSize(size);
+                if (lastChange.dwLowDateTime != 0 || lastChange.dwHighDateTime != 0)
+                {
+                    item->UpwardUpdateLastChange(lastChange);
+                }
+                files = subdirs = 0;
+                size = 0;
+                lastChange = {};
+            };
+
+            FileFindEnhanced finder(owners);
             for (BOOL b = finder.FindFile(item->GetPath()); b; b = finder.FindNextFile())
             {
                 if (finder.IsDots())
@@ -960,9 +1101,12 @@ void CItem::ScanItems(BlockingQueue<CItem*> * queue)
                     continue;
                 }
 
+                const FILETIME lastWrite = finder.GetLastWriteTime();
+                if (CompareFileTime(&lastWrite, &lastChange) == 1) lastChange = lastWrite;
+
                 if (finder.IsDirectory())
                 {
-                    item->UpwardAddSubdirs(1);
+                    subdirs++;
                     CItem* newitem = item->AddDirectory(finder);
                     if (newitem->GetReadJobs() > 0)
                     {
@@ -971,19 +1115,32 @@ void CItem::ScanItems(BlockingQueue<CItem*> * queue)
                 }
                 else
                 {
-                    item->UpwardAddFiles(1);
-                    item->AddFile(finder);
+                    files++;
+                    size += finder.GetFileSize();
+                    item->AddFile(finder, totals);
+                }
+
+                // Publish partial totals at a bounded rate for live progress
+                if (const ULONGLONG now = GetTickCount64(); now >= nextPublish)
+                {
+                    publish();
+                    nextPublish = now + PUBLISH_INTERVAL_MS;
                 }
 
                 // Update pacman position
                 item->UpwardDrivePacman();
             }
+
+            // Remaining totals must be in place before the read job
+            // is released below since that may mark the parents done
+            publish();
         }
         else if (item->IsType(IT_FILE))
         {
             // Only used for refreshes
             item->UpdateStatsFromDisk();
             item->SetDone();
+            CountExtension(totals, item->GetExtensionId(), item->GetSize());
         }
         else if (item->IsType(IT_MYCOMPUTER))
         {
@@ -996,6 +1153,12 @@ void CItem::ScanItems(BlockingQueue<CItem*> * queue)
         item->UpwardSubtractReadJobs(1);
         item->UpwardDrivePacman();
     }
+
+    // There is no document in headless mode
+    if (const auto doc = GetDocument(); doc != nullptr)
+    {
+        doc->AddExtensionTotals(totals);
+    }
 }
 
 void CItem::UpwardSetDone()
@@ -1158,35 +1321,63 @@ void CItem::RemoveUnknownItem()
     }
 } 
 
-void CItem::RecurseCollectExtensionData(CExtensionData* ed) const
+// Large trees are split into subtrees below COLLECT_SPLIT_ITEMS which
+// worker threads collect into totals of their own; these are added up
+// at the end. Files directly within the large directories are counted
+// by the calling thread while splitting.
+//
+void CItem::RecurseCollectExtensionData(CExtensionTotals& totals) const
 {
+    std::vector<const CItem*> subtrees;
     std::stack<const CItem*> queue;
     queue.push(this);
     while (!queue.empty())
     {
-        const auto& qitem = queue.top();
+        const auto qitem = queue.top();
         queue.pop();
         if (qitem->IsType(IT_FILE))
         {
-            const CStringW& ext = qitem->GetExtension();
-            SExtensionRecord r;
-            if (ed->Lookup(ext, r))
-            {
-                r.bytes += qitem->GetSize();
-                r.files++;
-            }
-            else
-            {
-                r.bytes = qitem->GetSize();
-                r.files = 1;
-            }
-            ed->SetAt(ext, r);
+            CountExtension(totals, qitem->GetExtensionId(), qitem->GetSize());
+        }
+        else if (qitem->GetItemsCount() < COLLECT_SPLIT_ITEMS)
+        {
+            subtrees.push_back(qitem);
         }
         else for (const auto& child : qitem->m_ci->m_children)
         {
             queue.push(child);
         }
     }
+
+    std::atomic<size_t> next = 0;
+    const auto collect = [&](CExtensionTotals& local)
+    {
+        for (size_t i = next++; i < subtrees.size(); i = next++)
+        {
+            CollectExtensions(subtrees[i], local);
+        }
+    };
+
+    const size_t threads = min(subtrees.size(), static_cast<size_t>(max(1u, std::thread::hardware_concurrency())));
+    std::vector<CExtensionTotals> locals(threads > 1 ? threads - 1 : 0);
+    std::vector<std::thread> workers;
+    for (auto& local : locals)
+    {
+        workers.emplace_back(collect, std::ref(local));
+    }
+    collect(totals);
+
+    for (size_t t = 0; t < workers.size(); t++)
+    {
+        workers[t].join();
+        const auto& local = locals[t];
+        if (local.size() > totals.size()) totals.resize(local.size());
+        for (size_t ext = 0; ext < local.size(); ext++)
+        {
+            totals[ext].files += local[ext].files;
+            totals[ext].bytes += local[ext].bytes;
+        }
+    }
 }
 
 ULONGLONG CItem::GetProgressRangeMyComputer() const
@@ -1227,7 +1418,7 @@ COLORREF CItem::GetGraphColor() const
 
     if (IsType(IT_FILE))
     {
-        return GetDocument()->GetCushionColor(GetExtension());
+        return GetDocument()->GetCushionColor(GetExtensionId());
     }
 
     return RGB(0, 0, 0);
@@ -1269,7 +1460,7 @@ CStringW CItem::UpwardGetPathWithoutBackslash() const
     {
         if (p->IsType(IT_DIRECTORY))
         {
-            path = p->m_name + L"\\" + path;
+            path = p->GetName() + L"\\" + path;
         }
         else if (p->IsType(IT_FILE))
         {
@@ -1293,19 +1484,22 @@ CItem* CItem::AddDirectory(const FileFindEnhanced& finder)
     const auto & child = new CItem(IT_DIRECTORY, finder.GetFileName());
     child->SetLastChange(finder.GetLastWriteTime());
     child->SetAttributes(finder.GetAttributes());
-    AddChild(child);
+    child->m_owner = finder.GetOwnerId();
+    AddChild(child, true);
     child->UpwardAddReadJobs(dontFollow ? 0 : 1);
     return child;
 }
 
-void CItem::AddFile(const FileFindEnhanced& finder)
+void CItem::AddFile(const FileFindEnhanced& finder, CExtensionTotals& totals)
 {
     const auto & child = new CItem(IT_FILE, finder.GetFileName());
     child->SetSize(finder.GetFileSize());
     child->SetLastChange(finder.GetLastWriteTime());
     child->SetAttributes(finder.GetAttributes());
-    AddChild(child);
+    child->m_owner = finder.GetOwnerId();
+    AddChild(child, true);
     child->SetDone();
+    CountExtension(totals, child->GetExtensionId(), child->GetSize());
 }
 
 void CItem::UpwardDrivePacman()
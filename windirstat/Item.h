@@ -26,6 +26,7 @@
 #include "DirStatDoc.h" // CExtensionData
 #include "FileFind.h" // FileFindEnhanced
 #include "BlockingQueue.h"
+#include "SlabAllocator.h"
 
 #include <mutex>
 
@@ -110,6 +111,16 @@ public:
     CItem(ITEMTYPE type, LPCWSTR name, FILETIME lastChange, ULONGLONG size, DWORD attributes, ULONG files, ULONG subdirs);
     ~CItem() override;
 
+    // Items and their child information are allocated from slabs
+    // which are released in bulk by PurgeAllocations()
+    static void* operator new(size_t size);
+    static void operator delete(void* p);
+    static void PurgeAllocations();
+
+    // Moves the names of the tree into fresh StringPool chunks once
+    // refreshes have left most of the pool unused; UI thread only
+    static void CompactNames(CItem* root);
+
     // CTreeListItem Interface
     bool DrawSubitem(int subitem, CDC* pdc, CRect rc, UINT state, int* width, int* focusLeft) const override;
     CStringW GetText(int subitem) const override;
@@ -158,6 +169,7 @@ public:
     ULONGLONG GetProgressPos() const;
     void UpdateStatsFromDisk();
     const std::vector<CItem*>& GetChildren() const;
+    bool TryCopyChildren(std::vector<CItem*>& children) const;
     CItem* GetParent() const;
     void AddChild(CItem* child, bool add_only = false);
     void RemoveChild(CItem* child);
@@ -184,18 +196,25 @@ public:
     bool IsRootItem() const;
     CStringW GetPath() const;
     CStringW GetOwner(bool force = false) const;
+    CStringW GetOwner(LPCWSTR path) const;
+    ULONG GetOwnerId(bool force = false) const;
     bool HasUncPath() const;
     CStringW GetFindPattern() const;
     CStringW GetFolderPath() const;
     CStringW GetReportPath() const;
     CStringW GetName() const;
+    std::wstring_view GetNameView() const
+    {
+        return { m_name, m_nameLen };
+    }
     CStringW GetExtension() const;
+    ULONG GetExtensionId() const;
     ULONG GetFilesCount() const;
     ULONG GetSubdirsCount() const;
     ULONGLONG GetItemsCount() const;
     void SetDone();
     ULONGLONG GetTicksWorked() const;
-    static void ScanItems(BlockingQueue<CItem*> *);
+    static void ScanItems(BlockingQueue<CItem*> *, bool owners = false);
     static void ScanItemsFinalize(CItem* item);
     void UpwardSetDone();
     void UpwardSetUndone();
@@ -208,7 +227,7 @@ public:
     CItem* FindUnknownItem() const;
     void UpdateUnknownItem();
     void RemoveUnknownItem();
-    void RecurseCollectExtensionData(CExtensionData* ed) const;
+    void RecurseCollectExtensionData(CExtensionTotals& totals) const;
 
     bool IsDone() const
     {
@@ -244,7 +263,7 @@ private:
     COLORREF GetPercentageColor() const;
     CStringW UpwardGetPathWithoutBackslash() const;
     CItem* AddDirectory(const FileFindEnhanced& finder);
-    void AddFile(const FileFindEnhanced& finder);
+    void AddFile(const FileFindEnhanced& finder, CExtensionTotals& totals);
     void UpwardDrivePacman();
 
     // Special structure for container items that is separately allocated to
@@ -259,15 +278,27 @@ private:
         std::atomic<ULONG> m_files = 0;   // # Files in subtree
         std::atomic<ULONG> m_subdirs = 0; // # Folder in subtree
         std::atomic<ULONG> m_jobs = 0;    // # "read jobs" in subtree.
+
+        static void* operator new(size_t)
+        {
+            return SlabAllocator<sizeof(CHILDINFO)>::Allocate();
+        }
+
+        static void operator delete(void* p)
+        {
+            SlabAllocator<sizeof(CHILDINFO)>::Free(p);
+        }
     }
     CHILDINFO;
 
     RECT m_rect;                   // To support GraphView
-    CStringW m_name;               // Display name
-    LPCWSTR m_extension;           // Cache of extension (it's used often)
+    LPCWSTR m_name;                // Display name (stored in the StringPool)
     FILETIME m_lastChange;         // Last modification time OF SUBTREE
     CHILDINFO* m_ci;               // Child information for non-files
     std::atomic<ULONGLONG> m_size; // OwnSize, if IT_FILE or IT_FREESPACE, or IT_UNKNOWN; SubtreeTotal else.
     DWORD m_attributes;            // Packed file attributes of the item
     ITEMTYPE m_type;               // Indicates our type.
+    USHORT m_nameLen;              // Length of m_name in characters
+    ULONG m_extension;             // Id of the extension in the ExtensionTable, if IT_FILE
+    ULONG m_owner;                 // Id of the owner in the OwnerTable if read while scanning, else OwnerTable::Pending
 };
@@ -95,6 +95,8 @@ Setting<int> COptions::TreeMapScaleFactor(L"options", L"scaleFactor", CTreemap::
 Setting<int> COptions::TreeMapAmbientLightPercent(L"options", L"ambientLight", CTreemap::GetDefaultOptions().GetAmbientLightPercent(), 0, 100);
 Setting<int> COptions::TreeMapLightSourceX(L"options", L"lightSourceX", CTreemap::GetDefaultOptions().GetLightSourceXPercent(), -200, 200);
 Setting<int> COptions::TreeMapLightSourceY(L"options", L"lightSourceY", CTreemap::GetDefaultOptions().GetLightSourceYPercent(), -200, 200);
+Setting<int> COptions::TreeMapDetailArea(L"options", L"treemapDetailArea", CTreemap::GetDefaultOptions().detailArea, 0, 4096);
+Setting<bool> COptions::TreeMapProgressive(L"options", L"treemapProgressive", true);
 Setting<bool> COptions::TreeMapGrid(L"options", L"treemapGrid", (CTreemap::GetDefaultOptions().grid));
 Setting<COLORREF> COptions::TreeMapGridColor(L"options", L"treemapGridColor", CTreemap::GetDefaultOptions().gridColor);
 Setting<COLORREF> COptions::TreeMapHighlightColor(L"options", L"treemapHighlightColor", RGB(255, 255, 255));
@@ -159,6 +161,7 @@ void COptions::SetTreemapOptions(const CTreemap::Options& options)
     TreeMapAmbientLightPercent = TreemapOptions.GetAmbientLightPercent();
     TreeMapLightSourceX = TreemapOptions.GetLightSourceXPercent();
     TreeMapLightSourceY = TreemapOptions.GetLightSourceYPercent();
+    TreeMapDetailArea = TreemapOptions.detailArea;
 
     GetDocument()->UpdateAllViews(nullptr, HINT_TREEMAPSTYLECHANGED);
 }
@@ -206,6 +209,7 @@ void COptions::PostProcessPersistedSettings()
     TreemapOptions.SetAmbientLightPercent(TreeMapAmbientLightPercent);
     TreemapOptions.SetLightSourceXPercent(TreeMapLightSourceX);
     TreemapOptions.SetLightSourceYPercent(TreeMapLightSourceY);
+    TreemapOptions.detailArea = TreeMapDetailArea;
 
     // Adjust title to language default title
     for (int i = 0; i < USERDEFINEDCLEANUPCOUNT; i++)
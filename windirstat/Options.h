@@ -165,6 +165,8 @@ public:
     static Setting<int> TreeMapAmbientLightPercent;
     static Setting<int> TreeMapLightSourceX;
     static Setting<int> TreeMapLightSourceY;
+    static Setting<int> TreeMapDetailArea;
+    static Setting<bool> TreeMapProgressive;
     static Setting<bool> TreeMapGrid;
     static Setting<COLORREF> TreeMapGridColor;
     static Setting<COLORREF> TreeMapHighlightColor;
@@ -0,0 +1,116 @@
+// OwnerTable.cpp - Implementation of OwnerTable
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "stdafx.h"
+#include "OwnerTable.h"
+#include "BackgroundResolver.h"
+#include "GlobalHelpers.h"
+#include "InternTable.h"
+#include <common/CommonHelpers.h>
+#include <common/SmartPointer.h>
+
+#include <aclapi.h>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Account names by SID
+    InternTable<std::vector<BYTE>, std::wstring, 1 << 10> _owners(OwnerTable::None + 1);
+
+    ULONG QueryOwner(const std::wstring& path)
+    {
+        return OwnerTable::Query(path.c_str());
+    }
+
+    // Owners of the rows on screen, 64 paths at a time by up to 4 callbacks
+    BackgroundResolver<ULONG, QueryOwner> _resolver(OwnerTable::WM_OWNERSRESOLVED, 64, 4);
+}
+
+ULONG OwnerTable::Intern(const PSID sid)
+{
+    if (sid == nullptr || !IsValidSid(sid))
+    {
+        return None;
+    }
+
+    const std::span sidBytes(static_cast<const BYTE*>(sid), GetLengthSid(sid));
+    const size_t hash = HashFnv1a(sidBytes.data(), sidBytes.size());
+    if (const auto e = _owners.Find(sidBytes, hash); e != nullptr)
+    {
+        return e->id;
+    }
+
+    // The account lookup may have to ask a domain controller, so it is
+    // done before taking the lock at the risk of doing it twice
+    return _owners.Insert(sidBytes, hash, GetNameFromSid(sid));
+}
+
+// Reads the owner of a file or folder from disk. This blocks, so the
+// views use Resolve() instead.
+//
+ULONG OwnerTable::Query(const LPCWSTR path)
+{
+    SmartPointer<PSECURITY_DESCRIPTOR> ps(LocalFree);
+    PSID sid = nullptr;
+    if (GetNamedSecurityInfo(path, SE_FILE_OBJECT, OWNER_SECURITY_INFORMATION,
+        &sid, nullptr, nullptr, nullptr, &ps) != ERROR_SUCCESS)
+    {
+        return None;
+    }
+    return Intern(sid);
+}
+
+bool OwnerTable::Resolve(const CStringW& path, const HWND notify, ULONG& id)
+{
+    return _resolver.Resolve(path.GetString(), notify, id);
+}
+
+void OwnerTable::Acknowledge(const HWND notify)
+{
+    _resolver.Acknowledge(notify);
+}
+
+void OwnerTable::ClearPending()
+{
+    _resolver.Clear();
+}
+
+LPCWSTR OwnerTable::GetName(const ULONG id)
+{
+    if (id == None || id >= _owners.GetCount())
+    {
+        return L"";
+    }
+    return _owners.Get(id).value.c_str();
+}
+
+// Siblings mostly share their owner, which the ids tell at once;
+// different owners are ordered by name.
+//
+int OwnerTable::Compare(const ULONG id1, const ULONG id2)
+{
+    if (id1 == id2)
+    {
+        return 0;
+    }
+    return signum(_wcsicmp(GetName(id1), GetName(id2)));
+}
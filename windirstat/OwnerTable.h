@@ -0,0 +1,49 @@
+// OwnerTable.h - Declaration of OwnerTable
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+//
+// OwnerTable. Gives each distinct owner SID a small id and looks up its
+// account name only once. Entries are never removed, so ids and names can
+// be read from any thread without locking. Owners of paths are looked up on
+// the thread pool in batches if the caller does not want to wait for them.
+//
+class OwnerTable final
+{
+public:
+    static constexpr ULONG None = 0;          // Owner could not be determined
+    static constexpr ULONG Pending = ULONG_MAX; // Owner not looked up yet
+    static constexpr UINT WM_OWNERSRESOLVED = WM_APP + 1; // Posted to controls, so not WM_USER based
+
+    static ULONG Intern(PSID sid);
+    static ULONG Query(LPCWSTR path);
+    static bool Resolve(const CStringW& path, HWND notify, ULONG& id);
+
+    // To be called on WM_OWNERSRESOLVED; owners found until then
+    // are announced by the message already posted
+    static void Acknowledge(HWND notify);
+
+    // Forgets the queued paths and the owners not picked up yet once the
+    // tree they belong to is gone; lookups still running are discarded
+    static void ClearPending();
+    static LPCWSTR GetName(ULONG id);
+    static int Compare(ULONG id1, ULONG id2);
+};
@@ -0,0 +1,188 @@
+// SlabAllocator.h - Fixed size block allocator for the item tree
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+//
+// SlabAllocator. Hands out blocks of a single size carved from large slabs.
+// Every thread bumps through a slab of its own so the scanning threads do not
+// contend on the process heap, and freed blocks are kept on a per-thread list
+// that spills into a shared list for reuse. Since the blocks carry no heap
+// header, a node costs exactly its (16 byte rounded) size.
+//
+// Purge() returns all slabs to the system in one go; it may only be called
+// once every block has been freed and no other thread is allocating.
+//
+template <size_t Size, size_t BlocksPerSlab = 4096>
+class SlabAllocator final
+{
+    static constexpr size_t BLOCK_ALIGN = alignof(std::max_align_t);
+    static constexpr size_t BLOCK_SIZE = (Size + BLOCK_ALIGN - 1) & ~(BLOCK_ALIGN - 1);
+    static constexpr size_t SLAB_SIZE = BLOCK_SIZE * BlocksPerSlab;
+    static constexpr size_t SPILL_COUNT = 1024;
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    struct ThreadCache
+    {
+        unsigned int generation = 0;
+        std::byte* cursor = nullptr;
+        std::byte* end = nullptr;
+        FreeBlock* head = nullptr;
+        FreeBlock* tail = nullptr;
+        size_t count = 0;
+
+        ~ThreadCache()
+        {
+            // Blocks freed by an exiting thread go back to the shared list
+            std::lock_guard lock(m_lock);
+            if (generation == m_generation) Spill(*this);
+        }
+    };
+
+    inline static std::mutex m_lock;
+    inline static std::vector<std::byte*> m_slabs;
+    inline static FreeBlock* m_free = nullptr;
+    inline static size_t m_freeCount = 0;
+    inline static std::atomic<bool> m_hasFree = false;
+    inline static std::atomic<unsigned int> m_generation = 1;
+#ifdef _DEBUG
+    inline static std::atomic<ptrdiff_t> m_live = 0;
+#endif
+    inline static thread_local ThreadCache m_cache;
+
+    // Must be called with m_lock held
+    static void Spill(ThreadCache& cache)
+    {
+        if (cache.head == nullptr) return;
+        cache.tail->next = m_free;
+        m_free = cache.head;
+        m_freeCount += cache.count;
+        m_hasFree = true;
+        cache.head = cache.tail = nullptr;
+        cache.count = 0;
+    }
+
+    static ThreadCache& GetCache()
+    {
+        // Anything cached from before the last purge points to released memory
+        ThreadCache& cache = m_cache;
+        if (const unsigned int generation = m_generation; cache.generation != generation)
+        {
+            cache = {};
+            cache.generation = generation;
+        }
+        return cache;
+    }
+
+public:
+    static void* Allocate()
+    {
+#ifdef _DEBUG
+        ++m_live;
+#endif
+        ThreadCache& cache = GetCache();
+
+        // Take over the shared free list if we have nothing of our own
+        if (cache.head == nullptr && m_hasFree)
+        {
+            std::lock_guard lock(m_lock);
+            cache.head = m_free;
+            cache.count = m_freeCount;
+            m_free = nullptr;
+            m_freeCount = 0;
+            m_hasFree = false;
+            if (cache.head != nullptr)
+            {
+                for (cache.tail = cache.head; cache.tail->next != nullptr; cache.tail = cache.tail->next) {}
+            }
+        }
+
+        // Reuse a freed block if possible
+        if (FreeBlock* block = cache.head; block != nullptr)
+        {
+            cache.head = block->next;
+            if (cache.head == nullptr) cache.tail = nullptr;
+            cache.count--;
+            return block;
+        }
+
+        // Otherwise bump allocate from our slab
+        if (cache.cursor == cache.end)
+        {
+            const auto slab = static_cast<std::byte*>(::operator new(SLAB_SIZE));
+            std::lock_guard lock(m_lock);
+            m_slabs.push_back(slab);
+            cache.cursor = slab;
+            cache.end = slab + SLAB_SIZE;
+        }
+
+        void* block = cache.cursor;
+        cache.cursor += BLOCK_SIZE;
+        return block;
+    }
+
+    static void Free(void* p)
+    {
+        if (p == nullptr) return;
+#ifdef _DEBUG
+        --m_live;
+#endif
+        ThreadCache& cache = GetCache();
+        const auto block = static_cast<FreeBlock*>(p);
+        block->next = cache.head;
+        if (cache.head == nullptr) cache.tail = block;
+        cache.head = block;
+
+        // Make the blocks available to other threads once there are enough
+        if (++cache.count >= SPILL_COUNT)
+        {
+            std::lock_guard lock(m_lock);
+            Spill(cache);
+        }
+    }
+
+    static void Purge()
+    {
+        std::lock_guard lock(m_lock);
+#ifdef _DEBUG
+        ASSERT(m_live == 0);
+#endif
+        for (const auto& slab : m_slabs)
+        {
+            ::operator delete(slab);
+        }
+        m_slabs.clear();
+        m_slabs.shrink_to_fit();
+        m_free = nullptr;
+        m_freeCount = 0;
+        m_hasFree = false;
+        ++m_generation;
+    }
+};
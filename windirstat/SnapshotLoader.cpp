@@ -0,0 +1,263 @@
+// SnapshotLoader.cpp - Implementation of the binary snapshot format
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "stdafx.h"
+#include "Item.h"
+#include "SmartPointer.h"
+#include "SnapshotLoader.h"
+
+#include <stack>
+#include <string>
+#include <vector>
+
+namespace
+{
+    constexpr char SNAPSHOT_MAGIC[8] = { 'W', 'D', 'S', 'S', 'N', 'A', 'P', '\0' };
+    constexpr ULONG SNAPSHOT_VERSION = 1;
+    constexpr ULONG NO_PARENT = ULONG_MAX;
+    constexpr size_t WRITE_BUFFER_SIZE = 4 * 1024 * 1024;
+
+    struct SnapshotHeader
+    {
+        char magic[8];
+        ULONG version;
+        ULONG recordSize;
+        ULONGLONG recordCount;
+        ULONGLONG namesOffset;  // Byte offset of the name pool
+        ULONGLONG namesLength;  // Characters in the name pool
+    };
+    static_assert(sizeof(SnapshotHeader) == 40);
+
+    struct SnapshotRecord
+    {
+        ULONGLONG size;
+        ULONGLONG lastChange;
+        ULONGLONG nameOffset;   // Characters into the name pool
+        ULONG parent;           // Index of the parent record or NO_PARENT
+        ULONG files;
+        ULONG subdirs;
+        ULONG attributes;
+        USHORT type;            // Raw ITEMTYPE including the flags
+        USHORT nameLength;
+        ULONG reserved;
+    };
+    static_assert(sizeof(SnapshotRecord) == 48);
+
+    //
+    // RegionWriter. Collects the writes for one region of the file and puts
+    // them out with large positioned writes, so that records and names can
+    // both be produced during the same pass over the tree.
+    //
+    class RegionWriter final
+    {
+        HANDLE m_file;
+        ULONGLONG m_offset;
+        std::vector<BYTE> m_buffer;
+        bool m_success = true;
+
+    public:
+        RegionWriter(HANDLE file, ULONGLONG offset) : m_file(file), m_offset(offset)
+        {
+            m_buffer.reserve(WRITE_BUFFER_SIZE);
+        }
+
+        void Write(const void* data, size_t size)
+        {
+            if (m_buffer.size() + size > WRITE_BUFFER_SIZE) Flush();
+            const auto bytes = static_cast<const BYTE*>(data);
+            m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+        }
+
+        bool Flush()
+        {
+            if (m_buffer.empty()) return m_success;
+
+            OVERLAPPED position = {};
+            position.Offset = static_cast<DWORD>(m_offset);
+            position.OffsetHigh = static_cast<DWORD>(m_offset >> 32);
+            DWORD written = 0;
+            m_success = m_success && WriteFile(m_file, m_buffer.data(),
+                static_cast<DWORD>(m_buffer.size()), &written, &position) && written == m_buffer.size();
+
+            m_offset += m_buffer.size();
+            m_buffer.clear();
+            return m_success;
+        }
+    };
+}
+
+bool IsSnapshotFile(const std::wstring& path)
+{
+    const size_t dot = path.rfind(L'.');
+    return dot != std::wstring::npos && _wcsicmp(path.c_str() + dot + 1, SNAPSHOT_EXTENSION) == 0;
+}
+
+bool SaveSnapshot(const std::wstring& path, const CItem* item)
+{
+    if (item == nullptr) return false;
+
+    // Count the items first so the name pool can start right after the records
+    ULONGLONG count = 0;
+    std::stack<const CItem*> queue;
+    queue.push(item);
+    while (!queue.empty())
+    {
+        const CItem* qitem = queue.top();
+        queue.pop();
+        count++;
+
+        if (qitem->IsType(IT_FILE)) continue;
+        for (const auto& child : qitem->GetChildren())
+        {
+            queue.push(child);
+        }
+    }
+    if (count >= NO_PARENT) return false;
+
+    const HANDLE handle = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+    SmartPointer<HANDLE> file(CloseHandle, handle);
+
+    SnapshotHeader header = {};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.recordSize = sizeof(SnapshotRecord);
+    header.recordCount = count;
+    header.namesOffset = sizeof(SnapshotHeader) + count * sizeof(SnapshotRecord);
+
+    // Walk the tree in pre-order so every parent gets a lower index than its children
+    RegionWriter records(file, sizeof(SnapshotHeader));
+    RegionWriter names(file, header.namesOffset);
+    std::stack<std::pair<const CItem*, ULONG>> pending;
+    pending.emplace(item, NO_PARENT);
+    for (ULONG index = 0; !pending.empty(); index++)
+    {
+        const auto [qitem, parent] = pending.top();
+        pending.pop();
+
+        // Drives are stored by their path since that is what they are created from
+        const CStringW drivePath = qitem->IsType(IT_DRIVE) ? qitem->GetPath() : CStringW();
+        const std::wstring_view name = qitem->IsType(IT_DRIVE) ?
+            std::wstring_view(drivePath.GetString(), drivePath.GetLength()) : qitem->GetNameView();
+
+        const FILETIME lastChange = qitem->GetLastChange();
+        const SnapshotRecord record =
+        {
+            .size = qitem->GetSize(),
+            .lastChange = static_cast<ULONGLONG>(lastChange.dwHighDateTime) << 32 | lastChange.dwLowDateTime,
+            .nameOffset = header.namesLength,
+            .parent = parent,
+            .files = qitem->GetFilesCount(),
+            .subdirs = qitem->GetSubdirsCount(),
+            .attributes = qitem->GetAttributes(),
+            .type = static_cast<USHORT>(qitem->GetRawType()),
+            .nameLength = static_cast<USHORT>(name.size()),
+        };
+        records.Write(&record, sizeof(record));
+        names.Write(name.data(), name.size() * sizeof(WCHAR));
+        names.Write(L"", sizeof(WCHAR));
+        header.namesLength += name.size() + 1;
+
+        if (qitem->IsType(IT_FILE)) continue;
+        for (const auto& child : qitem->GetChildren())
+        {
+            pending.emplace(child, index);
+        }
+    }
+
+    // The header goes last so an interrupted save never looks valid
+    if (!records.Flush() || !names.Flush()) return false;
+    OVERLAPPED position = {};
+    DWORD written = 0;
+    return WriteFile(file, &header, sizeof(header), &written, &position) && written == sizeof(header);
+}
+
+CItem* LoadSnapshot(const std::wstring& path)
+{
+    const HANDLE handle = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) return nullptr;
+    SmartPointer<HANDLE> file(CloseHandle, handle);
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(SnapshotHeader)))
+    {
+        return nullptr;
+    }
+
+    SmartPointer<HANDLE> mapping(CloseHandle, CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr));
+    if (mapping == nullptr) return nullptr;
+    SmartPointer<LPVOID> view(UnmapViewOfFile, MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (view == nullptr) return nullptr;
+
+    // Validate the layout against the actual size of the file
+    const auto base = static_cast<const BYTE*>(static_cast<LPVOID>(view));
+    const auto header = reinterpret_cast<const SnapshotHeader*>(base);
+    const auto size = static_cast<ULONGLONG>(fileSize.QuadPart);
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+        header->version != SNAPSHOT_VERSION || header->recordSize != sizeof(SnapshotRecord) ||
+        header->recordCount == 0 || header->recordCount >= NO_PARENT ||
+        header->namesOffset != sizeof(SnapshotHeader) + header->recordCount * sizeof(SnapshotRecord) ||
+        header->namesOffset > size || header->namesLength > (size - header->namesOffset) / sizeof(WCHAR))
+    {
+        return nullptr;
+    }
+
+    const auto records = reinterpret_cast<const SnapshotRecord*>(base + sizeof(SnapshotHeader));
+    const auto names = reinterpret_cast<LPCWSTR>(base + header->namesOffset);
+    const auto count = static_cast<ULONG>(header->recordCount);
+    std::vector<CItem*> items(count, nullptr);
+    for (ULONG i = 0; i < count; i++)
+    {
+        // Reject records pointing ahead of themselves or outside of the name pool
+        const SnapshotRecord& record = records[i];
+        if ((i == 0 ? record.parent != NO_PARENT : record.parent >= i || items[record.parent]->IsType(IT_FILE)) ||
+            record.nameOffset >= header->namesLength ||
+            header->namesLength - record.nameOffset <= record.nameLength ||
+            names[record.nameOffset + record.nameLength] != L'\0')
+        {
+            delete items[0];
+            return nullptr;
+        }
+
+        // Containers are only marked as done once all of their children are present
+        ITEMTYPE type = static_cast<ITEMTYPE>(record.type);
+        if (!(type & IT_FILE)) type = static_cast<ITEMTYPE>(type & ~ITF_DONE);
+
+        const auto newitem = new CItem(type,
+            names + record.nameOffset,
+            FILETIME{ static_cast<DWORD>(record.lastChange), static_cast<DWORD>(record.lastChange >> 32) },
+            record.size,
+            record.attributes,
+            record.files,
+            record.subdirs);
+        if (i > 0) items[record.parent]->AddChild(newitem, true);
+        items[i] = newitem;
+    }
+
+    // Children come after their parents so walking backwards finishes them first
+    for (auto item = items.rbegin(); item != items.rend(); ++item)
+    {
+        if (!(*item)->IsType(IT_FILE)) (*item)->SetDone();
+    }
+
+    return items[0];
+}
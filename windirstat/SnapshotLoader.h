@@ -0,0 +1,35 @@
+// SnapshotLoader.h - Declaration of the binary snapshot format
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+#include <string>
+
+class CItem;
+
+// Snapshots hold the same information as the CSV results but as fixed width
+// records which reference their parent by index, followed by a pool of the
+// null terminated UTF-16 names. Parents always precede their children so the
+// tree is rebuilt in a single pass over the memory mapped file.
+constexpr auto SNAPSHOT_EXTENSION = L"wdsnap";
+
+bool IsSnapshotFile(const std::wstring& path);
+bool SaveSnapshot(const std::wstring& path, const CItem* item);
+CItem* LoadSnapshot(const std::wstring& path);
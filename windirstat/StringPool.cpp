@@ -0,0 +1,126 @@
+// StringPool.cpp - Implementation of StringPool
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "stdafx.h"
+#include "StringPool.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    constexpr size_t CHUNK_CHARS = 64 * 1024;
+
+    // Compaction only pays off once a good part of a sizable pool is unused
+    constexpr size_t COMPACT_MIN_CHARS = 64 * CHUNK_CHARS;
+
+    std::mutex _chunkLock;
+    std::vector<std::unique_ptr<WCHAR[]>> _chunks;
+    size_t _allocatedChars = 0;
+    std::atomic<size_t> _releasedChars = 0;
+    std::atomic<unsigned int> _generation = 1;
+
+    struct ThreadChunk
+    {
+        unsigned int generation = 0;
+        WCHAR* cursor = nullptr;
+        WCHAR* end = nullptr;
+    };
+    thread_local ThreadChunk _threadChunk;
+
+    WCHAR* AllocateChunk(const size_t chars)
+    {
+        auto chunk = std::make_unique_for_overwrite<WCHAR[]>(chars);
+        WCHAR* memory = chunk.get();
+        std::lock_guard lock(_chunkLock);
+        _chunks.emplace_back(std::move(chunk));
+        _allocatedChars += chars;
+        return memory;
+    }
+}
+
+LPCWSTR StringPool::Add(const LPCWSTR str, const size_t length)
+{
+    const size_t needed = length + 1;
+    WCHAR* target;
+
+    if (needed > CHUNK_CHARS / 4)
+    {
+        // Unusually long strings get a chunk of their own
+        target = AllocateChunk(needed);
+    }
+    else
+    {
+        // Start a new chunk if ours is full or was released by Purge()
+        ThreadChunk& chunk = _threadChunk;
+        if (const unsigned int generation = _generation; chunk.generation != generation ||
+            static_cast<size_t>(chunk.end - chunk.cursor) < needed)
+        {
+            chunk.generation = generation;
+            chunk.cursor = AllocateChunk(CHUNK_CHARS);
+            chunk.end = chunk.cursor + CHUNK_CHARS;
+        }
+
+        target = chunk.cursor;
+        chunk.cursor += needed;
+    }
+
+    wmemcpy(target, str, length);
+    target[length] = L'\0';
+    return target;
+}
+
+void StringPool::Release(const size_t length)
+{
+    _releasedChars.fetch_add(length + 1, std::memory_order_relaxed);
+}
+
+bool StringPool::IsFragmented()
+{
+    std::lock_guard lock(_chunkLock);
+    return _allocatedChars >= COMPACT_MIN_CHARS && _releasedChars * 2 >= _allocatedChars;
+}
+
+void StringPool::Compact(const std::function<void()>& relocate)
+{
+    // Keep the old chunks alive until everything has been copied out
+    std::vector<std::unique_ptr<WCHAR[]>> old;
+    {
+        std::lock_guard lock(_chunkLock);
+        old.swap(_chunks);
+        _allocatedChars = 0;
+        _releasedChars = 0;
+        ++_generation;
+    }
+
+    relocate();
+}
+
+void StringPool::Purge()
+{
+    std::lock_guard lock(_chunkLock);
+    _chunks.clear();
+    _chunks.shrink_to_fit();
+    _allocatedChars = 0;
+    _releasedChars = 0;
+    ++_generation;
+}
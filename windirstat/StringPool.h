@@ -0,0 +1,47 @@
+// StringPool.h - Declaration of StringPool
+//
+// WinDirStat - Directory Statistics
+// Copyright (C) 2024 WinDirStat Team (windirstat.net)
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+#include <functional>
+
+//
+// StringPool. Stores the names of the items back to back in large chunks.
+// Each thread appends to a chunk of its own, so names of siblings which were
+// enumerated together also end up next to each other in memory. Strings are
+// never freed individually; Release() only counts the space that is no longer
+// referenced so that, once a refresh left enough of it behind, the owner can
+// copy the live strings into fresh chunks with Compact(). Purge() releases all
+// chunks once the tree that referenced them is gone.
+//
+class StringPool final
+{
+public:
+    // Copies the string into the pool and returns the null terminated copy
+    static LPCWSTR Add(LPCWSTR str, size_t length);
+    static void Release(size_t length);
+    static bool IsFragmented();
+
+    // Starts over with empty chunks, has relocate() Add() every string that is
+    // still referenced and then frees the old chunks; nothing else may use
+    // the pool or the old strings meanwhile
+    static void Compact(const std::function<void()>& relocate);
+    static void Purge();
+};
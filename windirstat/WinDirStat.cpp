@@ -32,6 +32,7 @@
 #include "GraphView.h"
 #include "OsSpecific.h"
 #include "GlobalHelpers.h"
+#include "HeadlessScan.h"
 #include "Item.h"
 #include "Localization.h"
 #include "SmartPointer.h"
@@ -86,6 +87,7 @@ CDirStatApp _theApp;
 CDirStatApp::CDirStatApp()
     : m_pDocTemplate(nullptr)
       , m_langid(0)
+      , m_headlessExitCode(-1)
       , m_altColor(GetAlternativeColor(RGB(0x00, 0x00, 0xFF), L"AltColor"))
       , m_altEncryptionColor(GetAlternativeColor(RGB(0x00, 0x80, 0x00), L"AltEncryptionColor"))
 #   ifdef VTRACE_TO_CONSOLE
@@ -292,6 +294,14 @@ BOOL CDirStatApp::InitInstance()
     SetPortableMode(true, true);
 
     COptions::LoadAppSettings();
+
+    // Run the command line scanner instead of the user interface if requested
+    if (IsHeadlessScanRequested())
+    {
+        m_headlessExitCode = RunHeadlessScan();
+        return FALSE;
+    }
+
     CWinAppEx::LoadStdProfileSettings(4);
 
     m_pDocTemplate = new CSingleDocTemplate(
@@ -360,7 +370,8 @@ BOOL CDirStatApp::InitInstance()
 
 int CDirStatApp::ExitInstance()
 {
-    return CWinAppEx::ExitInstance();
+    const int result = CWinAppEx::ExitInstance();
+    return m_headlessExitCode >= 0 ? m_headlessExitCode : result;
 }
 
 void CDirStatApp::OnAppAbout()
@@ -84,6 +84,7 @@ protected:
     CSingleDocTemplate* m_pDocTemplate; // MFC voodoo.
 
     LANGID m_langid;                          // Language we are running
+    int m_headlessExitCode;                   // Exit code of a command line scan, if one was run
     CReparsePoints m_mountPoints;             // Mount point information
     CMyImageList m_myImageList;               // Our central image list
     COLORREF m_altColor;                      // Coloring of compressed items
@@ -233,6 +233,7 @@
 #define IDS_GENERIC_NO                  20229
 #define IDS_GENERIC_OK                  20230
 #define IDS_GENERIC_CANCEL              20231
+#define IDS_SNAPSHOT_FILES              20232
 
 // Next default values for new objects
 // 